@@ -0,0 +1,355 @@
+#include "dqn_test.hpp"
+
+namespace {
+// in_channels, out_channels, board size, kernel
+void checkLocallyConnectedParity(const int64_t _in, const int64_t _out,
+		const int64_t _size, const int64_t _kernel) {
+	torch::manual_seed(0);
+	const auto output_size = compute_output_size(_size, _kernel, 1, 0);
+	LocallyConnected2D local(_in, _out, output_size, output_size, _kernel, 1);
+	auto x = torch::randn({8, _in, _size, _size});
+
+	auto bmm = local->forward(x);
+	auto grad_bmm = torch::autograd::grad({bmm.pow(2).sum()}, {local->m_W, local->m_b});
+	auto broadcast = local->forwardBroadcast(x);
+	auto grad_broadcast = torch::autograd::grad({broadcast.pow(2).sum()}, {local->m_W, local->m_b});
+
+	ASSERT_EQ(bmm.sizes(), broadcast.sizes());
+	ASSERT_TRUE(torch::allclose(bmm, broadcast, 1e-4, 1e-4));
+	ASSERT_TRUE(torch::allclose(grad_bmm[0], grad_broadcast[0], 1e-3, 1e-3));
+	ASSERT_TRUE(torch::allclose(grad_bmm[1], grad_broadcast[1], 1e-3, 1e-3));
+}
+
+template <typename Forward>
+double timeForwardBackward(LocallyConnected2D& local_, const torch::Tensor& _x,
+		Forward&& _forward, const int _reps) {
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < _reps; ++i) {
+		local_->zero_grad();
+		_forward(_x).sum().backward();
+	}
+	std::chrono::duration<double, std::milli> elapsed =
+		std::chrono::high_resolution_clock::now() - start;
+	return elapsed.count() / _reps;
+}
+}
+
+TEST(DQNTest, TestLocallyConnectedParity) {
+	// SmallDQN, citytile features
+	checkLocallyConnectedParity(2, SmallDQN::local_channels, 12, SmallDQN::local_kernel);
+	// BigDQN, worker features
+	checkLocallyConnectedParity(6, BigDQN::local_channels, 12, BigDQN::local_kernel);
+}
+
+TEST(DQNTest, BenchmarkLocallyConnected) {
+	const int reps = 10;
+	const int64_t batch_size = 256;
+	struct Config { const char* name; int64_t in; int64_t out; int64_t kernel; };
+	for (const auto& config : {Config{"SmallDQN", 2, SmallDQN::local_channels, SmallDQN::local_kernel},
+			Config{"BigDQN", 6, BigDQN::local_channels, BigDQN::local_kernel}}) {
+		for (const int64_t size : {12, 32}) {
+			const auto output_size = compute_output_size(size, config.kernel, 1, 0);
+			LocallyConnected2D local(config.in, config.out, output_size, output_size, config.kernel, 1);
+			auto x = torch::randn({batch_size, config.in, size, size});
+
+			const double broadcast_ms = timeForwardBackward(local, x,
+				[&](const torch::Tensor& _x) { return local->forwardBroadcast(_x); }, reps);
+			const double bmm_ms = timeForwardBackward(local, x,
+				[&](const torch::Tensor& _x) { return local->forward(_x); }, reps);
+
+			std::cout << config.name << " k=" << config.kernel << " size=" << size
+				<< " batch=" << batch_size << " broadcast ms: " << broadcast_ms
+				<< " bmm ms: " << bmm_ms << std::endl;
+		}
+	}
+}
+
+TEST(DQNTest, TestLocallyConnectedContiguous) {
+	LocallyConnected2D local(2, 2, 10, 10, 3, 1);
+	ASSERT_TRUE(local->forward(torch::randn({4, 2, 12, 12})).is_contiguous());
+}
+
+TEST(DQNTest, TestChannelsLastParity) {
+	torch::manual_seed(0);
+	const int64_t size = 12, actions = 6, atoms = 51;
+	BigDQN dqn(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	auto x = torch::rand({16, 6, size, size});
+	const auto nchw = dqn.forward(x);
+
+	dqn.toChannelsLast();
+	FlatParameters flat(dqn);
+	ASSERT_TRUE(dqn.m_conv2->weight.is_contiguous(at::MemoryFormat::ChannelsLast));
+	ASSERT_TRUE(dqn.m_local1->forward(x).is_contiguous(at::MemoryFormat::ChannelsLast));
+	ASSERT_TRUE(torch::allclose(dqn.forward(x), nchw, 1e-5, 1e-6));
+}
+
+TEST(DQNTest, BenchmarkChannelsLast) {
+	const int reps = 10;
+	const int64_t size = 12, actions = 6, atoms = 51;
+	torch::manual_seed(0);
+	BigDQN nchw(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	BigDQN nhwc(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	nhwc.toChannelsLast();
+	const auto time_forward = [reps](BigDQN &model_, const torch::Tensor &_x,
+			const bool _backward) {
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < reps; ++i) {
+			if (_backward) {
+				model_.zero_grad();
+				model_.forward(_x).sum().backward();
+			} else {
+				torch::NoGradGuard no_grad;
+				model_.forward(_x);
+			}
+		}
+		std::chrono::duration<double, std::milli> elapsed =
+			std::chrono::high_resolution_clock::now() - start;
+		return elapsed.count() / reps;
+	};
+	for (const int64_t batch_size : {1, 8, 32, 64, 128, 256}) {
+		auto x = torch::rand({batch_size, 6, size, size});
+		std::cout << "batch=" << batch_size
+			<< " forward ms nchw: " << time_forward(nchw, x, false)
+			<< " channels_last: " << time_forward(nhwc, x, false)
+			<< " train step ms nchw: " << time_forward(nchw, x, true)
+			<< " channels_last: " << time_forward(nhwc, x, true) << std::endl;
+	}
+}
+
+TEST(DQNTest, TestBoardDQNSharedBoard) {
+	torch::manual_seed(0);
+	const int64_t size = 12, actions = 8, atoms = 51;
+	BoardDQN dqn(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	auto board = torch::rand({1, 6, size, size});
+	auto positions = torch::tensor({0, 13, 77, 143}, torch::dtype(torch::kInt64));
+
+	// one shared board must match the board repeated per unit
+	auto shared = dqn.forward(board, positions);
+	auto repeated = dqn.forward(board.expand({4, 6, size, size}), positions);
+	ASSERT_EQ(shared.sizes(), torch::IntArrayRef({4, actions, atoms}));
+	ASSERT_TRUE(torch::allclose(shared, repeated, 1e-5, 1e-6));
+	ASSERT_TRUE(torch::allclose(shared.sum(2), torch::ones({4, actions}), 1e-5, 1e-5));
+}
+
+TEST(DQNTest, TestFactorizedNoiseSeeded) {
+	const int64_t size = 12, actions = 8, atoms = 51;
+	torch::manual_seed(0);
+	BoardDQN first(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	torch::manual_seed(1);
+	BoardDQN second(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	first.m_noise.seed(7);
+	second.m_noise.seed(7);
+
+	// same seed, same stream, whatever the global generator did in between
+	first.resetNoise();
+	torch::randn({16});
+	second.resetNoise();
+	ASSERT_TRUE(torch::equal(first.m_head->m_linear1_a->m_weight_epsilon,
+		second.m_head->m_linear1_a->m_weight_epsilon));
+	ASSERT_TRUE(torch::equal(first.m_head->m_linear2_a->m_bias_epsilon,
+		second.m_head->m_linear2_a->m_bias_epsilon));
+
+	const auto previous = first.m_head->m_linear2_a->m_weight_epsilon.clone();
+	first.resetNoise();
+	ASSERT_FALSE(torch::equal(previous, first.m_head->m_linear2_a->m_weight_epsilon));
+
+	// still factorized: weight epsilon is the outer product with the bias one
+	const auto &weight_epsilon = first.m_head->m_linear1_a->m_weight_epsilon;
+	const auto &bias_epsilon = first.m_head->m_linear1_a->m_bias_epsilon;
+	const auto epsilon_in = weight_epsilon[0] / bias_epsilon[0];
+	ASSERT_TRUE(torch::allclose(weight_epsilon,
+		bias_epsilon.unsqueeze(1) * epsilon_in.unsqueeze(0), 1e-4, 1e-5));
+}
+
+TEST(DQNTest, TestFrozenModuleParity) {
+	torch::manual_seed(0);
+	const int64_t size = 12, actions = 8, atoms = 51;
+	BigDQN dqn(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	FrozenModule<BigDQN, torch::kCPU> frozen(dqn, 6, size);
+	ASSERT_TRUE(dqn.is_training());
+
+	// frozen forward is the eval forward, noise folded to mu
+	auto x = torch::rand({5, 6, size, size});
+	dqn.eval();
+	auto eager = dqn.forward(x);
+	dqn.train();
+	ASSERT_TRUE(torch::allclose(frozen.forward(x), eager, 1e-5, 1e-6));
+
+	// snapshot, not a view of the eager weights
+	{
+		torch::NoGradGuard no_grad;
+		for (auto& parameter : dqn.parameters()) { parameter.add_(1.f); }
+	}
+	ASSERT_TRUE(torch::allclose(frozen.forward(x), eager, 1e-5, 1e-6));
+}
+
+namespace {
+// geometric features saved with torch::save from real games when
+// LUX_RECORDED_OBSERVATIONS points at them, random boards otherwise
+torch::Tensor loadObservations(const int64_t _channels, const int64_t _size) {
+	torch::Tensor observations;
+	if (const char* path = std::getenv("LUX_RECORDED_OBSERVATIONS")) {
+		torch::load(observations, path);
+	} else {
+		observations = torch::rand({512, _channels, _size, _size});
+	}
+	return observations;
+}
+}
+
+TEST(DQNTest, TestQuantizedGreedyAgreement) {
+	torch::manual_seed(0);
+	const int64_t size = 12, actions = 8;
+	BigDQN dqn(6, size, actions, HyperParameters::m_nn_std_init, HyperParameters::m_nn_atom_count,
+		HyperParameters::m_nn_v_min, HyperParameters::m_nn_v_max);
+	// quantizing a live network must not change its mode
+	QuantizedBigDQN quantized(dqn);
+	ASSERT_TRUE(dqn.is_training());
+	dqn.eval();
+	quantized.requantize();
+	ASSERT_FALSE(dqn.is_training());
+	auto support = torch::linspace(HyperParameters::m_nn_v_min, HyperParameters::m_nn_v_max,
+		HyperParameters::m_nn_atom_count);
+	auto observations = loadObservations(6, size);
+
+	const float agreement = greedy_agreement(dqn, quantized, observations, support);
+	std::cout << "greedy agreement: " << agreement << std::endl;
+	ASSERT_GE(agreement, 0.9f);
+
+	torch::NoGradGuard no_grad;
+	auto q_float = (dqn.forward(observations) * support).sum(2);
+	auto q_quantized = (quantized.forward(observations) * support).sum(2);
+	ASSERT_LT((q_float - q_quantized).abs().max().item<float>(),
+		0.05f * (HyperParameters::m_nn_v_max - HyperParameters::m_nn_v_min));
+}
+
+TEST(DQNTest, BenchmarkQuantized) {
+	const int reps = 50;
+	const int64_t size = 12, actions = 8;
+	BigDQN dqn(6, size, actions, HyperParameters::m_nn_std_init, HyperParameters::m_nn_atom_count,
+		HyperParameters::m_nn_v_min, HyperParameters::m_nn_v_max);
+	dqn.eval();
+	QuantizedBigDQN quantized(dqn);
+	torch::NoGradGuard no_grad;
+	for (const int64_t batch_size : {1, 16, 64}) {
+		auto x = torch::rand({batch_size, 6, size, size});
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < reps; ++i) { dqn.forward(x); }
+		std::chrono::duration<double, std::micro> float_us =
+			std::chrono::high_resolution_clock::now() - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < reps; ++i) { quantized.forward(x); }
+		std::chrono::duration<double, std::micro> int8_us =
+			std::chrono::high_resolution_clock::now() - start;
+
+		std::cout << "BigDQN batch=" << batch_size << " fp32 us: " << float_us.count() / reps
+			<< " int8 us: " << int8_us.count() / reps << std::endl;
+	}
+}
+
+TEST(DQNTest, TestModelRegistry) {
+	const std::string path = "dqn_test_models.cfg";
+	{
+		std::ofstream file(path);
+		file << "# comment line\n";
+		file << "worker_model = BoardDQN # trailing comment\n";
+	}
+	const auto selection = read_model_selection(path, {"BigDQN", "SmallDQN"});
+	std::remove(path.c_str());
+	ASSERT_EQ(selection.m_worker, "BoardDQN");
+	ASSERT_EQ(selection.m_citytile, "SmallDQN");
+
+	std::string worker, citytile;
+	dispatch_models(selection, [&](auto worker_tag, auto citytile_tag) {
+		using WorkerDQN = typename decltype(worker_tag)::type;
+		using CityTileDQN = typename decltype(citytile_tag)::type;
+		worker = model_name<WorkerDQN>::value;
+		citytile = model_name<CityTileDQN>::value;
+		ASSERT_TRUE(is_board_model<WorkerDQN>::value);
+	});
+	ASSERT_EQ(worker, "BoardDQN");
+	ASSERT_EQ(citytile, "SmallDQN");
+
+	ASSERT_FALSE(CityTileModelRegistry::dispatch("BigDQN", [](auto) {}));
+	ASSERT_EQ(WorkerModelRegistry::names(), "BigDQN, BoardDQN");
+}
+
+TEST(DQNTest, TestBoardSizes) {
+	torch::manual_seed(0);
+	const int64_t actions = 8, atoms = 51;
+	// BigDQN flattens a board sized trunk
+	for (const int64_t size : {12, 16, 32}) {
+		BigDQN dqn(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+		auto output = dqn.forward(torch::rand({3, 6, size, size}));
+		ASSERT_EQ(output.sizes(), torch::IntArrayRef({3, actions, atoms}));
+	}
+
+	// BoardDQN weights carry over to any board size
+	BoardDQN small(6, 12, actions, 0.5f, atoms, 0.f, 40.f);
+	BoardDQN large(6, 24, actions, 0.5f, atoms, 0.f, 40.f);
+	ASSERT_TRUE(is_size_invariant_model<BoardDQN>::value);
+	ASSERT_FALSE(is_size_invariant_model<BigDQN>::value);
+	{
+		torch::NoGradGuard no_grad;
+		const auto from = small.parameters();
+		auto to = large.parameters();
+		ASSERT_EQ(from.size(), to.size());
+		for (std::size_t i = 0; i < from.size(); ++i) {
+			to[i].copy_(from[i]);
+		}
+	}
+	auto positions = torch::tensor({0, 25, 300, 575}, torch::dtype(torch::kInt64));
+	auto output = large.forward(torch::rand({1, 6, 24, 24}), positions);
+	ASSERT_EQ(output.sizes(), torch::IntArrayRef({4, actions, atoms}));
+
+	int dispatched = 0;
+	ASSERT_TRUE(BoardSizes::dispatch(24, [&](auto board_tag) {
+		dispatched = decltype(board_tag)::type::size;
+	}));
+	ASSERT_EQ(dispatched, 24);
+	ASSERT_FALSE(BoardSizes::dispatch(20, [](auto) {}));
+	ASSERT_EQ(BoardSizes::names(), "12, 16, 24, 32");
+	ASSERT_EQ(board_path<BoardConfig>("worker.pt"), "worker.pt");
+	ASSERT_EQ(board_path<SizedBoardConfig<16>>("worker.pt"), "worker_16.pt");
+	ASSERT_EQ(board_path<SizedBoardConfig<16>>("replay"), "replay_16");
+}
+
+TEST(DQNTest, TestInferenceServerBatching) {
+	torch::manual_seed(0);
+	const int64_t size = 12, actions = 8, atoms = 51;
+	const int clients = 8;
+	BoardDQN dqn(6, size, actions, 0.5f, atoms, 0.f, 40.f);
+	dqn.eval();
+	std::vector<torch::Tensor> boards, positions, expected(clients), served(clients);
+	for (int i = 0; i < clients; ++i) {
+		boards.push_back(torch::rand({1, 6, size, size}));
+		positions.push_back(torch::randint(size * size, {i + 1}, torch::dtype(torch::kInt64)));
+	}
+	{
+		torch::NoGradGuard no_grad;
+		for (int i = 0; i < clients; ++i) {
+			expected[i] = dqn.forward(boards[i], positions[i]);
+		}
+	}
+
+	// a generous deadline so concurrent requests land in shared batches
+	InferenceServer<BoardDQN> server(dqn, 1024, std::chrono::microseconds(20000));
+	std::vector<std::thread> threads;
+	for (int i = 0; i < clients; ++i) {
+		threads.emplace_back([&, i] {
+			InferenceClient<InferenceServer<BoardDQN>> client(server);
+			served[i] = client.forward(boards[i], positions[i]);
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	for (int i = 0; i < clients; ++i) {
+		ASSERT_TRUE(torch::allclose(served[i], expected[i], 1e-5, 1e-6));
+	}
+	ASSERT_EQ(server.getQueueDelay().getCount(), clients);
+	ASSERT_EQ(server.getBatchRows().getSum(), clients * (clients + 1) / 2);
+	ASSERT_LT(server.getBatchRows().getCount(), clients);
+}
@@ -0,0 +1,21 @@
+#ifndef DQN_TEST_HPP
+#define DQN_TEST_HPP
+
+#include "gtest/gtest.h"
+#include "board_config.hpp"
+#include "dqn.hpp"
+#include "flat_parameters.hpp"
+#include "frozen_module.hpp"
+#include "hyper_parameters.hpp"
+#include "inference_server.hpp"
+#include "model_registry.hpp"
+#include "quantized_dqn.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+#endif /* DQN_TEST_HPP */
@@ -14,6 +14,58 @@ TEST(MathUtilsTest, TestChoice) {
     std::cout << indices << std::endl;
 }
 
+TEST(MathUtilsTest, TestSumTree) {
+	SumTree tree(5);
+	tree.set(0, 1.f);
+	tree.set(1, 2.f);
+	tree.set(3, 3.f);
+	tree.set(4, 4.f);
+	ASSERT_FLOAT_EQ(tree.total(), 10.f);
+	ASSERT_EQ(tree.find(0.5f), 0);
+	ASSERT_EQ(tree.find(2.5f), 1);
+	ASSERT_EQ(tree.find(3.5f), 3);
+	ASSERT_EQ(tree.find(9.9f), 4);
+
+	tree.set(1, 0.f);
+	ASSERT_FLOAT_EQ(tree.total(), 8.f);
+	ASSERT_EQ(tree.find(1.5f), 3);
+}
+
+TEST(MathUtilsTest, TestSumTreeRandomSets) {
+	// a partly filled shard, the leaves past stored stay empty
+	const unsigned capacity = 1000, stored = 700;
+	SumTree tree(capacity);
+	std::mt19937 rng(0);
+	std::uniform_int_distribution<unsigned> index(0, stored - 1);
+	std::uniform_real_distribution<float> exponent(-4.f, 4.f);
+	std::vector<float> leaves(capacity, 0.f);
+	for (unsigned i = 0; i < stored; ++i) {
+		leaves[i] = 1.f;
+		tree.set(i, 1.f);
+	}
+	for (int step = 0; step < 20000; ++step) {
+		const unsigned i = index(rng);
+		leaves[i] = std::pow(10.f, exponent(rng));
+		tree.set(i, leaves[i]);
+		if (step % 1000 != 0) {
+			continue;
+		}
+		const double sum = std::accumulate(leaves.begin(), leaves.end(), 0.);
+		ASSERT_NEAR(tree.total(), sum, 1e-5 * sum);
+	}
+
+	// every draw up to the upper boundary lands on a stored leaf
+	const float total = tree.total();
+	std::uniform_real_distribution<float> mass(0.f, total);
+	for (int draw = 0; draw < 10000; ++draw) {
+		const unsigned found = tree.find(draw < 100
+			? std::nextafter(total, 0.f) - draw * total * 1e-7f : mass(rng));
+		ASSERT_LT(found, stored);
+		ASSERT_GT(tree.get(found), 0.f);
+	}
+	ASSERT_LT(tree.find(total), stored);
+}
+
 TEST(MathUtilsTest, TestMinMaxNorm) {
 	auto tensor = torch::ones({5,5});
 	auto a = tensor.accessor<float,2>();
@@ -71,3 +123,216 @@ TEST(MathUtilsTest, TestForward) {
 	std::cout << next_dist << std::endl;
 
 }
+
+TEST(MathUtilsTest, TestMaskedArgmax) {
+	// unit 0 may only stay, unit 1 may do anything but its best action
+	auto bits = torch::tensor({int64_t{1}, int64_t{0b1101}});
+	auto legal = expand_action_mask(bits, 4);
+	ASSERT_EQ(legal.size(0), 2);
+	ASSERT_EQ(legal.size(1), 4);
+	ASSERT_TRUE(legal[0][0].item<bool>());
+	ASSERT_FALSE(legal[0][3].item<bool>());
+	ASSERT_FALSE(legal[1][1].item<bool>());
+
+	auto values = torch::tensor({0.f, 1.f, 2.f, 3.f, 1.f, 9.f, 5.f, 2.f}).reshape({2, 4});
+	auto argmax = masked_argmax(values, legal);
+	ASSERT_EQ(argmax[0].item<int64_t>(), 0);
+	ASSERT_EQ(argmax[1].item<int64_t>(), 2);
+}
+
+TEST(MathUtilsTest, TestConflictResolver) {
+	kit::Agent agent;
+	agent.id = 0;
+	agent.map = lux::GameMap(BoardConfig::size, BoardConfig::size);
+	auto &units = agent.players[0].units;
+	units.emplace_back(0, 0, "u_1", 5, 5, 0, 0, 0, 0); // east into (6,5)
+	units.emplace_back(0, 0, "u_2", 7, 5, 0, 0, 0, 0); // west into (6,5)
+	units.emplace_back(0, 0, "u_3", 3, 3, 0, 0, 0, 0); // east onto u_4
+	units.emplace_back(0, 0, "u_4", 4, 3, 0, 0, 0, 0); // stays
+	units.emplace_back(0, 0, "u_5", 8, 9, 0, 0, 0, 0); // east into own city
+	units.emplace_back(0, 0, "u_6", 10, 9, 0, 0, 0, 0); // west into own city
+	agent.players[0].cities["c_1"] = lux::City(0, "c_1", 0, 0);
+	agent.players[0].cities["c_1"].addCityTile(9, 9, 0);
+
+	const float inf = std::numeric_limits<float>::infinity();
+	const auto values = torch::tensor({4.f, 1.f, 3.f, 2.f, 6.f, 5.f, 0.f, -inf, 2.f, 1.f, 1.f, 0.f})
+		.reshape({6, 2});
+	const auto ranked = torch::tensor({
+		int64_t{WorkerActionInt::east}, int64_t{WorkerActionInt::center},
+		int64_t{WorkerActionInt::west}, int64_t{WorkerActionInt::center},
+		int64_t{WorkerActionInt::east}, int64_t{WorkerActionInt::south},
+		int64_t{WorkerActionInt::center}, int64_t{WorkerActionInt::north},
+		int64_t{WorkerActionInt::east}, int64_t{WorkerActionInt::center},
+		int64_t{WorkerActionInt::west}, int64_t{WorkerActionInt::center}}).reshape({6, 2});
+
+	ConflictResolver<BoardConfig> resolver;
+	Eigen::ArrayXi actions(6);
+	resolver.resolve(agent, values, ranked, actions);
+	ASSERT_EQ(actions(0), WorkerActionInt::east);
+	ASSERT_EQ(actions(1), WorkerActionInt::center);
+	ASSERT_EQ(actions(2), WorkerActionInt::south);
+	ASSERT_EQ(actions(3), WorkerActionInt::center);
+	ASSERT_EQ(actions(4), WorkerActionInt::east);
+	ASSERT_EQ(actions(5), WorkerActionInt::west);
+}
+
+TEST(MathUtilsTest, BenchmarkConflictResolver) {
+	// a crowded 32x32 endgame: workers, opponent units and both players'
+	// citytiles on distinct cells, each call rebuilds the boards from them
+	using Board = SizedBoardConfig<32>;
+	const int reps = 2000, opponent_units = 64, citytiles = 64;
+	const int64_t ranks = static_cast<int64_t>(WorkerActions::Count);
+	std::mt19937 rng(0);
+	torch::manual_seed(0);
+	for (const int worker_count : {100, 200, 400}) {
+		kit::Agent agent;
+		agent.id = 0;
+		agent.map = lux::GameMap(Board::size, Board::size);
+		std::vector<int> cells(Board::size * Board::size);
+		std::iota(cells.begin(), cells.end(), 0);
+		std::shuffle(cells.begin(), cells.end(), rng);
+		auto cell = cells.begin();
+		for (int i = 0; i < worker_count; ++i, ++cell) {
+			agent.players[0].units.emplace_back(0, 0, "u_" + std::to_string(i),
+				*cell % Board::size, *cell / Board::size, 0, 0, 0, 0);
+		}
+		for (int i = 0; i < opponent_units; ++i, ++cell) {
+			agent.players[1].units.emplace_back(1, 0, "u_o" + std::to_string(i),
+				*cell % Board::size, *cell / Board::size, 0, 0, 0, 0);
+		}
+		agent.players[0].cities["c_1"] = lux::City(0, "c_1", 0, 0);
+		agent.players[1].cities["c_2"] = lux::City(1, "c_2", 0, 0);
+		for (int i = 0; i < 2 * citytiles; ++i, ++cell) {
+			agent.players[i % 2].cities[i % 2 ? "c_2" : "c_1"].addCityTile(
+				*cell % Board::size, *cell / Board::size, 0);
+		}
+		const auto values = std::get<0>(torch::rand({worker_count, ranks}).sort(1, true));
+		const auto ranked = torch::rand({worker_count, ranks}).argsort(1);
+
+		ConflictResolver<Board> resolver;
+		Eigen::ArrayXi actions(worker_count);
+		resolver.resolve(agent, values, ranked, actions);
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < reps; ++i) {
+			resolver.resolve(agent, values, ranked, actions);
+		}
+		const std::chrono::duration<double, std::micro> elapsed =
+			std::chrono::high_resolution_clock::now() - start;
+		std::cout << "workers: " << worker_count << " resolve us: "
+			<< elapsed.count() / reps << std::endl;
+	}
+}
+
+TEST(MathUtilsTest, TestHeuristicPolicy) {
+	kit::Agent agent;
+	agent.id = 0;
+	agent.map = lux::GameMap(BoardConfig::size, BoardConfig::size);
+	agent.map._setResource(lux::ResourceType::wood, 2, 5, 100);
+	agent.map._setResource(lux::ResourceType::coal, 6, 5, 100);
+	auto &units = agent.players[0].units;
+	units.emplace_back(0, 0, "u_1", 5, 5, 0, 0, 0, 0); // empty, coal unresearched
+	units.emplace_back(0, 0, "u_2", 9, 9, 0, 100, 0, 0); // full, back to city
+	units.emplace_back(0, 0, "u_3", 2, 6, 2, 0, 0, 0); // cooling down
+	agent.players[0].cities["c_1"] = lux::City(0, "c_1", 0, 0);
+	agent.players[0].cities["c_1"].addCityTile(9, 7, 0);
+
+	HeuristicPolicy<BoardConfig> policy;
+	const auto actions = std::get<0>(policy.act(agent));
+	ASSERT_EQ(actions.size(), 3);
+	ASSERT_EQ(actions(0), WorkerActionInt::west);
+	ASSERT_EQ(actions(1), WorkerActionInt::north);
+	ASSERT_EQ(actions(2), WorkerActionInt::center);
+}
+
+TEST(MathUtilsTest, TestSendActions) {
+	kit::Agent agent;
+	agent.id = 0;
+	agent.map = lux::GameMap(BoardConfig::size, BoardConfig::size);
+	auto &units = agent.players[0].units;
+	units.emplace_back(0, 0, "u_1", 2, 2, 2, 0, 0, 0); // cooling down
+	units.emplace_back(0, 0, "u_2", 3, 3, 0, 0, 0, 0);
+	units.emplace_back(0, 0, "u_3", 4, 4, 0, 0, 0, 0);
+	agent.players[0].cities["c_1"] = lux::City(0, "c_1", 0, 0);
+	agent.players[0].cities["c_1"].addCityTile(6, 6, 0);
+	agent.players[0].cities["c_1"].addCityTile(6, 7, 0); // NONE
+	agent.players[0].cities["c_1"].addCityTile(6, 8, 0);
+
+	Eigen::ArrayXi workers(3), citytiles(3);
+	workers << WorkerActionInt::north, WorkerActionInt::east, WorkerActionInt::west;
+	citytiles << static_cast<int>(CityTileActions::BUILD_WORKER),
+		static_cast<int>(CityTileActions::NONE),
+		static_cast<int>(CityTileActions::RESEARCH);
+	char membuf[256];
+	send_actions(agent, std::make_tuple(workers, citytiles), membuf);
+	// no separator for the skipped worker or the idle tile
+	ASSERT_STREQ(membuf, "?m u_2 e,m u_3 w,bw 6 6,r 6 8\nD_FINISH\n");
+
+	// only idle citytiles, nothing to separate
+	units.clear();
+	citytiles.setConstant(static_cast<int>(CityTileActions::NONE));
+	send_actions(agent, std::make_tuple(Eigen::ArrayXi(0), citytiles), membuf);
+	ASSERT_STREQ(membuf, "?\nD_FINISH\n");
+}
+
+TEST(MathUtilsTest, TestApexEpsilon) {
+	const float epsilon = .4f, alpha = 7.f;
+	// a single actor keeps the base epsilon
+	ASSERT_FLOAT_EQ(apex_epsilon(0, 1, epsilon, alpha), epsilon);
+	ASSERT_FLOAT_EQ(apex_epsilon(0, 2, epsilon, alpha), epsilon);
+	ASSERT_FLOAT_EQ(apex_epsilon(1, 2, epsilon, alpha), std::pow(epsilon, 1 + alpha));
+
+	const std::size_t actor_count = 8;
+	ASSERT_FLOAT_EQ(apex_epsilon(0, actor_count, epsilon, alpha), epsilon);
+	ASSERT_FLOAT_EQ(apex_epsilon(actor_count - 1, actor_count, epsilon, alpha),
+		std::pow(epsilon, 1 + alpha));
+	// evenly spaced exponents, each actor a constant factor greedier
+	for (std::size_t actor = 1; actor < actor_count; ++actor) {
+		ASSERT_LT(apex_epsilon(actor, actor_count, epsilon, alpha),
+			apex_epsilon(actor - 1, actor_count, epsilon, alpha));
+		ASSERT_NEAR(apex_epsilon(actor, actor_count, epsilon, alpha) /
+			apex_epsilon(actor - 1, actor_count, epsilon, alpha),
+			std::pow(epsilon, alpha / (actor_count - 1)), 1e-5);
+	}
+}
+
+TEST(MathUtilsTest, TestWaitStopped) {
+	// an actor thread whose forwarder never answers must still join once
+	// the trainer raises the stop flag
+	std::atomic<bool> stop{false};
+	char membuf[16] = {};
+	bool is_new_game = true, is_message = true, is_forwarded = true;
+	std::thread actor([&] {
+		is_message = wait_for_next_msg(membuf, stop, is_new_game);
+		is_forwarded = wait_for_client_to_forward_actions(membuf, stop);
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	stop = true;
+	actor.join();
+	ASSERT_FALSE(is_message);
+	ASSERT_FALSE(is_forwarded);
+	ASSERT_TRUE(is_new_game);
+	ASSERT_EQ(membuf[0], ack_input_received);
+}
+
+TEST(MathUtilsTest, TestTurnScheduler) {
+	using namespace std::chrono_literals;
+	TurnScheduler turn(40, 400, 0, true);
+	turn.startGame();
+	turn.startTurn(10);
+	// no estimate yet, always admitted
+	ASSERT_TRUE(turn.run(TurnStage::Learner, [] { std::this_thread::sleep_for(30ms); }));
+	ASSERT_GE(turn.getEstimate(TurnStage::Learner), 30.);
+	// 30 ms in, another 30 ms step does not fit in 40
+	ASSERT_FALSE(turn.run(TurnStage::Learner, [] { std::this_thread::sleep_for(30ms); }));
+	ASSERT_EQ(turn.getSkipped(TurnStage::Learner), 1);
+	// unless it may draw on its share of the bank, 400 / 10 turns
+	ASSERT_TRUE(turn.admit(TurnStage::Learner, true));
+	ASSERT_EQ(turn.endTurn(), 0.);
+	ASSERT_EQ(turn.getBank(), 400.);
+
+	turn.startTurn(9);
+	std::this_thread::sleep_for(60ms);
+	const double overrun = turn.endTurn();
+	ASSERT_GE(overrun, 20.);
+	ASSERT_DOUBLE_EQ(turn.getBank(), 400. - overrun);
+}
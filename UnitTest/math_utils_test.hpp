@@ -2,8 +2,24 @@
 #define MATH_UTILS_TEST_HPP
 
 #include "gtest/gtest.h"
+#include "actions.hpp"
+#include "agent_io.hpp"
+#include "board_config.hpp"
+#include "conflict_resolver.hpp"
+#include "heuristic_policy.hpp"
 #include "math_util.hpp"
 #include "random_engine.hpp"
+#include "sum_tree.hpp"
+#include "turn_scheduler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 #endif /* MATH_UTILS_TEST_HPP */
@@ -0,0 +1,486 @@
+#include "model_learner_test.hpp"
+
+namespace {
+constexpr int64_t atom_count = HyperParameters::m_nn_atom_count;
+
+struct ProjectionInputs {
+	ProjectionInputs(const int64_t _batch_size)
+		: m_reward(torch::randn({_batch_size}) * 2.f),
+		  m_is_non_terminal(torch::rand({_batch_size}) > 0.2),
+		  m_probabilities(torch::softmax(
+			  torch::randn({_batch_size, atom_count}), 1)),
+		  m_support(torch::linspace(HyperParameters::m_nn_v_min,
+			  HyperParameters::m_nn_v_max, atom_count)),
+		  m_offset(torch::linspace(0,
+			  (_batch_size - 1) * atom_count, _batch_size,
+			  torch::dtype(torch::kInt32)).unsqueeze(1)
+			  .expand({_batch_size, atom_count})),
+		  m_gamma(std::pow(HyperParameters::m_nn_gamma, HyperParameters::m_nn_step_size)) {}
+
+	torch::Tensor m_reward;
+	torch::Tensor m_is_non_terminal;
+	torch::Tensor m_probabilities;
+	torch::Tensor m_support;
+	torch::Tensor m_offset;
+	float m_gamma;
+};
+
+// replay and learner stand-ins for AsyncLearner: the learner counts its
+// steps and can be held inside train until released
+struct WarmingReplay {
+	static constexpr bool is_persistent = false;
+	inline bool isCapacityReached() const { return false; }
+};
+
+struct GatedLearner {
+	template <typename ReplayBuf, typename RandomEngine>
+	void train(const std::size_t _frame, ReplayBuf &, RandomEngine &) {
+		while (!m_is_open.load()) {
+			std::this_thread::yield();
+		}
+		m_last_frame = _frame;
+		++m_steps;
+	}
+
+	std::atomic<bool> m_is_open{true};
+	std::atomic<std::size_t> m_last_frame{0};
+	std::atomic<std::size_t> m_steps{0};
+};
+
+using GatedAsyncLearner = AsyncLearner<GatedLearner, SmallDQN, WarmingReplay,
+	WeightSnapshot, RandomEngine<float, 13>>;
+
+// learner steps once they reach _steps, or whatever was done at the deadline
+template <typename Learner>
+std::size_t waitForSteps(const Learner &_learner, const std::size_t _steps) {
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (_learner.getSteps() < _steps && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	// and no step past the budget
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	return _learner.getSteps();
+}
+
+// every parameter and buffer of model_ set to _value
+template <typename Model> void fillModel(Model &model_, const float _value) {
+	torch::NoGradGuard no_grad;
+	for (auto &tensor : WeightSnapshot::modelTensors(model_)) {
+		tensor.fill_(_value);
+	}
+}
+
+// the value every tensor of _model holds, -1 if they disagree
+template <typename Model> float modelValue(const Model &_model) {
+	const auto tensors = WeightSnapshot::modelTensors(_model);
+	const float value = tensors.front().flatten()[0].template item<float>();
+	for (const auto &tensor : tensors) {
+		if (!torch::all(tensor == value).template item<bool>()) {
+			return -1;
+		}
+	}
+	return value;
+}
+
+void removeSegment(const key_t _key) {
+	const int shmid = shmget(_key, 0, 0666);
+	if (shmid >= 0) {
+		shmctl(shmid, IPC_RMID, nullptr);
+	}
+}
+}
+
+TEST(ModelLearnerTest, TestProjectionParity) {
+	torch::manual_seed(0);
+	const int64_t batch_size = 256;
+	ProjectionInputs inputs(batch_size);
+	const float delta_z = (HyperParameters::m_nn_v_max - HyperParameters::m_nn_v_min) /
+		(atom_count - 1);
+	// terminal rows landing exactly on an atom, on each bound and past them
+	inputs.m_is_non_terminal.index_put_({torch::indexing::Slice(0, 4)}, false);
+	inputs.m_reward[0] = HyperParameters::m_nn_v_min;
+	inputs.m_reward[1] = HyperParameters::m_nn_v_max + 1.f;
+	inputs.m_reward[2] = HyperParameters::m_nn_v_min + 3 * delta_z;
+	inputs.m_reward[3] = 0.f;
+
+	auto reference = torch::empty({batch_size, atom_count});
+	auto fused = torch::empty({batch_size, atom_count});
+	project_categorical_reference(inputs.m_reward, inputs.m_is_non_terminal,
+		inputs.m_probabilities, inputs.m_support, inputs.m_offset, inputs.m_gamma,
+		HyperParameters::m_nn_v_min, HyperParameters::m_nn_v_max, reference);
+	project_categorical(inputs.m_reward, inputs.m_is_non_terminal,
+		inputs.m_probabilities, inputs.m_gamma, HyperParameters::m_nn_v_min,
+		HyperParameters::m_nn_v_max, fused);
+
+	ASSERT_TRUE(torch::allclose(reference, fused, 1e-5, 1e-6));
+	ASSERT_TRUE(torch::allclose(fused.sum(1), torch::ones({batch_size}), 1e-5, 1e-5));
+}
+
+TEST(ModelLearnerTest, BenchmarkProjection) {
+	const int reps = 200;
+	for (const int64_t batch_size : {32, 64, 128, 256, 512, 1024}) {
+		ProjectionInputs inputs(batch_size);
+		auto distribution = torch::empty({batch_size, atom_count});
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < reps; ++i) {
+			project_categorical_reference(inputs.m_reward, inputs.m_is_non_terminal,
+				inputs.m_probabilities, inputs.m_support, inputs.m_offset, inputs.m_gamma,
+				HyperParameters::m_nn_v_min, HyperParameters::m_nn_v_max, distribution);
+		}
+		std::chrono::duration<double, std::micro> reference_us =
+			std::chrono::high_resolution_clock::now() - start;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < reps; ++i) {
+			project_categorical(inputs.m_reward, inputs.m_is_non_terminal,
+				inputs.m_probabilities, inputs.m_gamma, HyperParameters::m_nn_v_min,
+				HyperParameters::m_nn_v_max, distribution);
+		}
+		std::chrono::duration<double, std::micro> fused_us =
+			std::chrono::high_resolution_clock::now() - start;
+
+		std::cout << "batch: " << batch_size
+			<< " reference us: " << reference_us.count() / reps
+			<< " fused us: " << fused_us.count() / reps << std::endl;
+	}
+}
+
+TEST(ModelLearnerTest, TestCheckpointRoundTrip) {
+	torch::manual_seed(0);
+	const auto input = torch::rand({8, 2, 12, 12});
+	const auto sgd_step = [&input](SmallDQN &model_, torch::optim::SGD &optimizer_) {
+		optimizer_.zero_grad();
+		model_.forward(input).pow(2).mean().backward();
+		optimizer_.step();
+	};
+	const auto sgd_options = torch::optim::SGDOptions(0.1).momentum(0.9);
+
+	SmallDQN model(2, 12, 6);
+	torch::optim::SGD optimizer(model.parameters(), sgd_options);
+	sgd_step(model, optimizer);
+
+	const std::string path = "model_learner_test_checkpoint.pt";
+	{
+		CheckpointWriter writer;
+		torch::serialize::OutputArchive archive, module_archive, optimizer_archive;
+		save_module_state(module_archive, model);
+		save_sgd_state(optimizer_archive, optimizer);
+		archive.write("module", module_archive);
+		archive.write("optimizer", optimizer_archive);
+		writer.submit(path, std::move(archive));
+		writer.wait();
+		EXPECT_NE(access((path + ".tmp").c_str(), F_OK), 0);
+	}
+
+	// perturb the original after the snapshot, the checkpoint must not see it
+	sgd_step(model, optimizer);
+	const auto expected = model.linear2->weight.clone();
+
+	torch::manual_seed(1);
+	SmallDQN restored(2, 12, 6);
+	torch::optim::SGD restored_optimizer(restored.parameters(), sgd_options);
+	torch::serialize::InputArchive archive, module_archive, optimizer_archive;
+	archive.load_from(path);
+	archive.read("module", module_archive);
+	archive.read("optimizer", optimizer_archive);
+	load_module_state(module_archive, restored);
+	load_sgd_state(optimizer_archive, restored_optimizer);
+	sgd_step(restored, restored_optimizer);
+	std::remove(path.c_str());
+
+	EXPECT_TRUE(torch::allclose(restored.linear2->weight, expected));
+}
+
+TEST(ModelLearnerTest, TestFlatParametersSync) {
+	torch::manual_seed(0);
+	SmallDQN dynamic(2, 12, 6), target(2, 12, 6);
+	torch::optim::SGD optimizer(dynamic.parameters(), torch::optim::SGDOptions(0.1));
+	FlatParameters flat_dynamic(dynamic), flat_target(target);
+
+	// parameters are views into the flat buffer and still train
+	const auto before = flat_dynamic.getFlat().clone();
+	optimizer.zero_grad();
+	dynamic.forward(torch::rand({4, 2, 12, 12})).sum().backward();
+	optimizer.step();
+	EXPECT_FALSE(torch::equal(before, flat_dynamic.getFlat()));
+	EXPECT_EQ(dynamic.linear2->weight.data_ptr<float>(),
+		flat_dynamic.getFlat().data_ptr<float>() +
+			(flat_dynamic.getFlat().numel() - dynamic.linear2->weight.numel() -
+			 dynamic.linear2->bias.numel()));
+
+	flat_target.copyFrom(flat_dynamic);
+	const auto dynamic_params = dynamic.parameters();
+	const auto target_params = target.parameters();
+	for (std::size_t i = 0; i < dynamic_params.size(); ++i) {
+		EXPECT_TRUE(torch::equal(dynamic_params[i], target_params[i]));
+	}
+
+	const auto target_weight = target.linear1->weight.clone();
+	torch::NoGradGuard no_grad;
+	dynamic.linear1->weight.add_(1.f);
+	flat_target.lerpFrom(flat_dynamic, 0.25f);
+	EXPECT_TRUE(torch::allclose(target.linear1->weight, target_weight + 0.25f));
+}
+
+TEST(ModelLearnerTest, TestAsyncLearnerSteps) {
+	SmallDQN dqn(2, 12, 6);
+	WeightSnapshot snapshot(dqn);
+	WarmingReplay replay;
+	GatedLearner learner;
+	{
+		// warm after frame 10, two steps per frame, publish every fourth
+		GatedAsyncLearner async_learner(learner, dqn, replay, snapshot, 10, 2.f, 4, 0);
+		for (std::size_t frame = 1; frame <= 10; ++frame) {
+			async_learner.notifyFrame(frame);
+		}
+		ASSERT_EQ(waitForSteps(async_learner, 0), 0);
+		ASSERT_EQ(snapshot.getVersion(), 0);
+
+		for (std::size_t frame = 11; frame <= 30; ++frame) {
+			async_learner.notifyFrame(frame);
+		}
+		ASSERT_EQ(waitForSteps(async_learner, 40), 40);
+		ASSERT_EQ(learner.m_steps.load(), 40);
+		ASSERT_EQ(learner.m_last_frame.load(), 30);
+		ASSERT_EQ(snapshot.getVersion(), 10);
+
+		// a late report of an older frame owes nothing
+		async_learner.notifyFrame(29);
+		ASSERT_EQ(waitForSteps(async_learner, 40), 40);
+	}
+	ASSERT_EQ(learner.m_steps.load(), 40);
+}
+
+TEST(ModelLearnerTest, TestAsyncLearnerBackpressure) {
+	SmallDQN dqn(2, 12, 6);
+	WeightSnapshot snapshot(dqn);
+	WarmingReplay replay;
+	GatedLearner learner;
+	learner.m_is_open = false;
+	GatedAsyncLearner async_learner(learner, dqn, replay, snapshot, 0, 1.f, 1, 2);
+
+	// two steps owed is within the lag, the third blocks the actor
+	async_learner.notifyFrame(1);
+	async_learner.notifyFrame(2);
+	std::atomic<bool> is_notified{false};
+	std::thread actor([&] {
+		async_learner.notifyFrame(3);
+		is_notified = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_FALSE(is_notified.load());
+	EXPECT_EQ(async_learner.getSteps(), 0);
+
+	learner.m_is_open = true;
+	actor.join();
+	ASSERT_TRUE(is_notified.load());
+	ASSERT_EQ(waitForSteps(async_learner, 3), 3);
+	ASSERT_EQ(snapshot.getVersion(), 3);
+}
+
+TEST(ModelLearnerTest, TestAsyncLearnerPaused) {
+	SmallDQN dqn(2, 12, 6);
+	WeightSnapshot snapshot(dqn);
+	WarmingReplay replay;
+	GatedLearner learner;
+	GatedAsyncLearner async_learner(learner, dqn, replay, snapshot, 0, 1.f, 1, 0);
+	async_learner.notifyFrame(1);
+	ASSERT_EQ(waitForSteps(async_learner, 1), 1);
+
+	async_learner.withLearnerPaused([&] {
+		for (std::size_t frame = 2; frame <= 5; ++frame) {
+			async_learner.notifyFrame(frame);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		EXPECT_EQ(async_learner.getSteps(), 1);
+		EXPECT_EQ(snapshot.getVersion(), 1);
+	});
+	ASSERT_EQ(waitForSteps(async_learner, 5), 5);
+	ASSERT_EQ(snapshot.getVersion(), 5);
+}
+
+TEST(ModelLearnerTest, BenchmarkAsyncLearner) {
+	using WorkerBatch = DynamicBatch<torch::kCPU, BoardConfig::size, WorkerModelConfig>;
+	using Replay = ReplayBuffer<torch::kCPU, WorkerBatch,
+		Transition<torch::kCPU, BoardConfig::size, WorkerModelConfig>>;
+	using Learner = ModelLearner<BigDQN, torch::kCPU,
+		static_cast<std::size_t>(WorkerActions::Count)>;
+	using LearnerRandomEngine = RandomEngine<float, 14>;
+	const unsigned capacity = 4096, frames = 100;
+	const auto make_dqn = [] {
+		return BigDQN(WorkerModelConfig::channels, BoardConfig::size,
+			static_cast<uint64_t>(WorkerActions::Count), HyperParameters::m_nn_std_init,
+			HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+			HyperParameters::m_nn_v_max);
+	};
+	WorkerBatch pushed(capacity);
+	pushed.zero_();
+	pushed.m_state.m_geometric.uniform_();
+	pushed.m_next_state.m_geometric.uniform_();
+	Replay replay(capacity, HyperParameters::m_replay_batch_size, HyperParameters::m_replay_alpha,
+		HyperParameters::m_replay_beta, HyperParameters::m_replay_beta_decay);
+	replay.push(pushed, capacity);
+
+	torch::manual_seed(0);
+	BigDQN dqn = make_dqn(), acting_dqn = make_dqn();
+	Learner learner(dqn, unsigned(WorkerModelConfig::channels), unsigned(BoardConfig::size),
+		static_cast<uint64_t>(WorkerActions::Count), HyperParameters::m_nn_std_init,
+		HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+		HyperParameters::m_nn_v_max);
+	WeightSnapshot snapshot(dqn);
+	const auto observation = torch::rand({16, WorkerModelConfig::channels,
+		BoardConfig::size, BoardConfig::size});
+	uint64_t acting_version = 0;
+
+	// one turn of the acting thread: pull the newest weights, act
+	const auto act = [&] {
+		snapshot.acquire(acting_dqn, acting_version);
+		torch::NoGradGuard no_grad;
+		acting_dqn.forward(observation);
+	};
+	const auto per_second = [](const double _count,
+			const std::chrono::steady_clock::time_point _start) {
+		const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - _start;
+		return _count / elapsed.count();
+	};
+
+	auto &random_engine = LearnerRandomEngine::getInstance();
+	const auto ratio = HyperParameters::m_learner_replay_ratio;
+	auto start = std::chrono::steady_clock::now();
+	std::size_t synchronous_steps = 0;
+	for (unsigned frame = 1; frame <= frames; ++frame) {
+		act();
+		for (; synchronous_steps < static_cast<std::size_t>(ratio * frame); ++synchronous_steps) {
+			learner.train(frame, replay, random_engine);
+		}
+		if (synchronous_steps % HyperParameters::m_learner_publish_interval == 0) {
+			snapshot.publish(dqn);
+		}
+	}
+	const double synchronous = per_second(frames, start);
+
+	start = std::chrono::steady_clock::now();
+	double async = 0, learner_steps = 0;
+	{
+		AsyncLearner<Learner, BigDQN, Replay, WeightSnapshot, LearnerRandomEngine> async_learner(
+			learner, dqn, replay, snapshot, 0, ratio,
+			HyperParameters::m_learner_publish_interval, HyperParameters::m_learner_max_lag);
+		for (unsigned frame = 1; frame <= frames; ++frame) {
+			act();
+			async_learner.notifyFrame(frame);
+		}
+		async = per_second(frames, start);
+		learner_steps = per_second(async_learner.getSteps(), start);
+	}
+	std::cout << "frames/s synchronous: " << synchronous << " async: " << async
+		<< " learner steps/s async: " << learner_steps << std::endl;
+}
+
+TEST(ModelLearnerTest, TestSharedWeightSnapshotNoTearing) {
+	const key_t key = 5800;
+	removeSegment(key);
+	const int publishes = 50;
+	const auto make_dqn = [] {
+		return std::make_unique<BigDQN>(WorkerModelConfig::channels, BoardConfig::size,
+			static_cast<uint64_t>(WorkerActions::Count), HyperParameters::m_nn_std_init,
+			HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+			HyperParameters::m_nn_v_max);
+	};
+	auto published = make_dqn(), acquired = make_dqn();
+	SharedWeightSnapshot learner_side(*published, key);
+	// a second attach by key, as an actor would
+	SharedWeightSnapshot actor_side(*acquired, key);
+
+	std::atomic<bool> is_done{false};
+	std::thread publisher([&] {
+		for (int value = 1; value <= publishes; ++value) {
+			fillModel(*published, static_cast<float>(value));
+			learner_side.publish(*published);
+		}
+		is_done = true;
+	});
+	uint64_t version = 0;
+	int acquires = 0, torn = 0;
+	float last_value = 0;
+	while (!is_done.load() || actor_side.getVersion() != version) {
+		if (!actor_side.acquire(*acquired, version)) {
+			std::this_thread::yield();
+			continue;
+		}
+		++acquires;
+		// a torn copy mixes values (-1), a stale one goes backwards
+		const float value = modelValue(*acquired);
+		torn += value < last_value;
+		last_value = std::max(last_value, value);
+	}
+	publisher.join();
+	removeSegment(key);
+
+	EXPECT_EQ(torn, 0);
+	EXPECT_GT(acquires, 0);
+	EXPECT_EQ(version, publishes);
+	EXPECT_EQ(modelValue(*acquired), static_cast<float>(publishes));
+}
+
+TEST(ModelLearnerTest, TestSharedWeightSnapshotLayoutChange) {
+	const key_t key = 5801;
+	removeSegment(key);
+	SmallDQN small(2, 12, 6);
+	fillModel(small, 1.f);
+	{
+		SharedWeightSnapshot stale(small, key);
+		stale.publish(small);
+		ASSERT_EQ(stale.getVersion(), 1);
+	}
+
+	// a larger model on the same key cannot attach to the smaller segment
+	// and replaces it
+	SmallDQN large(4, 12, 6), other(4, 12, 6);
+	fillModel(large, 2.f);
+	{
+		SharedWeightSnapshot replaced(large, key), reader(other, key);
+		ASSERT_EQ(replaced.getVersion(), 0);
+		replaced.publish(large);
+		uint64_t version = 0;
+		ASSERT_TRUE(reader.acquire(other, version));
+		ASSERT_EQ(version, 1);
+		ASSERT_FLOAT_EQ(modelValue(other), 2.f);
+	}
+
+	// a smaller one fits the larger segment, but does not read its weights
+	{
+		SharedWeightSnapshot shrunk(small, key);
+		ASSERT_EQ(shrunk.getVersion(), 0);
+		fillModel(small, 3.f);
+		shrunk.publish(small);
+		SmallDQN restored(2, 12, 6);
+		uint64_t version = 0;
+		ASSERT_TRUE(shrunk.acquire(restored, version));
+		ASSERT_FLOAT_EQ(modelValue(restored), 3.f);
+	}
+
+	// an equal byte count with another layout is replaced as well
+	torch::nn::LinearImpl wide(torch::nn::LinearOptions(4, 6).bias(false)),
+		tall(torch::nn::LinearOptions(6, 4).bias(false));
+	fillModel(wide, 4.f);
+	{
+		SharedWeightSnapshot written(wide, key);
+		written.publish(wide);
+	}
+	{
+		SharedWeightSnapshot mismatched(tall, key);
+		ASSERT_EQ(mismatched.getVersion(), 0);
+	}
+	removeSegment(key);
+
+	// as are the NCHW and channels_last layouts of one model
+	BigDQN nchw(WorkerModelConfig::channels, BoardConfig::size,
+		static_cast<uint64_t>(WorkerActions::Count), HyperParameters::m_nn_std_init,
+		HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+		HyperParameters::m_nn_v_max);
+	const uint64_t nchw_layout = SharedWeightSnapshot::layoutHash(nchw);
+	nchw.toChannelsLast();
+	ASSERT_NE(SharedWeightSnapshot::layoutHash(nchw), nchw_layout);
+}
@@ -0,0 +1,29 @@
+#ifndef MODEL_LEARNER_TEST_HPP
+#define MODEL_LEARNER_TEST_HPP
+
+#include "gtest/gtest.h"
+#include "actions.hpp"
+#include "async_learner.hpp"
+#include "board_config.hpp"
+#include "categorical_projection.hpp"
+#include "checkpoint.hpp"
+#include "data_objects.hpp"
+#include "dqn.hpp"
+#include "flat_parameters.hpp"
+#include "hyper_parameters.hpp"
+#include "model_config.hpp"
+#include "model_learner.hpp"
+#include "random_engine.hpp"
+#include "replay_buffer.hpp"
+#include "shared_weight_snapshot.hpp"
+#include "weight_snapshot.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <sys/shm.h>
+#include <thread>
+#include <unistd.h>
+
+
+#endif /* MODEL_LEARNER_TEST_HPP */
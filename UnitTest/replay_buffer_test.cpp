@@ -0,0 +1,383 @@
+#include "replay_buffer_test.hpp"
+
+namespace {
+using WorkerBatch = DynamicBatch<torch::kCPU, BoardConfig::size, WorkerModelConfig>;
+using WorkerExample = Transition<torch::kCPU, BoardConfig::size, WorkerModelConfig>;
+using TestRandomEngine = RandomEngine<float, 11>;
+
+// rows of batch_ hold markers _first, _first + 1, ... in their boards and
+// rewards, so a sampled row can be traced back to its push
+void markBatch(WorkerBatch &batch_, const unsigned _count, const float _first) {
+	batch_.zero_();
+	for (unsigned r = 0; r < _count; ++r) {
+		const float marker = _first + r;
+		batch_.m_state.m_geometric[r].fill_(marker);
+		batch_.m_next_state.m_geometric[r].fill_(marker);
+		batch_.m_reward[r] = marker;
+		batch_.m_action[r] = static_cast<int64_t>(r % static_cast<unsigned>(WorkerActions::Count));
+	}
+}
+
+// Stands in for the replay behind a PrefetchSampler: each draw records how
+// many priority updates it saw and the draw the last one belonged to
+struct RecordingReplay {
+	static constexpr bool is_persistent = false;
+
+	struct Batch {
+		explicit Batch(const unsigned) {}
+		int m_draw = -1;
+		int m_updates_seen = -1;
+		int m_last_update = -1;
+	};
+
+	explicit RecordingReplay(const unsigned _batch_size) : m_batch_size(_batch_size) {}
+
+	inline unsigned getBatchSize() const { return m_batch_size; }
+	inline bool isCapacityReached() const { return false; }
+
+	template <typename RandomEngine>
+	void sampleInto(RandomEngine &, const unsigned, Batch &batch_,
+			Eigen::Ref<Eigen::ArrayXi> choices_) {
+		batch_.m_draw = m_draws;
+		batch_.m_updates_seen = m_updates;
+		batch_.m_last_update = m_last_update;
+		choices_.setConstant(m_draws++);
+	}
+
+	void updatePrios(const torch::Tensor &, const Eigen::Ref<const Eigen::ArrayXi> &_choices) {
+		++m_updates;
+		m_last_update = _choices(0);
+	}
+
+	void push(const Batch &, const std::size_t) {}
+
+	const unsigned m_batch_size;
+	int m_draws = 0;
+	int m_updates = 0;
+	int m_last_update = -1;
+};
+
+// every sampled row is whole: both boards carry the row's reward marker
+void expectWholeRows(const WorkerBatch &_batch, const unsigned _rows) {
+	for (unsigned i = 0; i < _rows; ++i) {
+		const float marker = _batch.m_reward[i].item<float>();
+		EXPECT_TRUE(torch::all(_batch.m_state.m_geometric[i] == marker).item<bool>());
+		EXPECT_TRUE(torch::all(_batch.m_next_state.m_geometric[i] == marker).item<bool>());
+	}
+}
+}
+
+TEST(ReplayBufferTest, TestMMapReopen) {
+	using Replay = MMapReplayBuffer<torch::kCPU, WorkerBatch, WorkerExample>;
+	const std::string path = "replay_buffer_test.mmap";
+	std::remove(path.c_str());
+	const unsigned capacity = 16, batch_size = 4;
+	WorkerBatch pushed(6);
+	markBatch(pushed, 6, 1);
+	Eigen::ArrayXf prios;
+	{
+		Replay replay(capacity, batch_size, .6f, .4f, 1000, path);
+		ASSERT_EQ(replay.size(), 0);
+		replay.push(pushed, 6);
+		Eigen::ArrayXi choices(batch_size);
+		choices << 0, 2, 4, 5;
+		replay.updatePrios(torch::tensor({.5f, 2.f, 3.f, 4.f}), choices);
+		prios = replay.getPrios();
+	}
+
+	Replay reopened(capacity, batch_size, .6f, .4f, 1000, path);
+	ASSERT_EQ(reopened.size(), 6);
+	ASSERT_EQ(reopened.getPos(), 6);
+	ASSERT_TRUE(reopened.getPrios().isApprox(prios));
+	ASSERT_FLOAT_EQ(reopened.getPrios()(2), 2.f);
+
+	// slot j still holds marker j + 1
+	WorkerBatch sampled(batch_size);
+	Eigen::ArrayXi choices(batch_size);
+	reopened.sampleInto(TestRandomEngine::getInstance(), 0, sampled, choices);
+	for (unsigned i = 0; i < batch_size; ++i) {
+		ASSERT_FLOAT_EQ(sampled.m_reward[i].item<float>(), choices(i) + 1.f);
+	}
+	expectWholeRows(sampled, batch_size);
+
+	// the cursor carries on, 12 more wrap around the end
+	WorkerBatch more(12);
+	markBatch(more, 12, 7);
+	reopened.push(more, 12);
+	ASSERT_EQ(reopened.size(), capacity);
+	ASSERT_EQ(reopened.getPos(), 2);
+	reopened.flush();
+	std::remove(path.c_str());
+}
+
+TEST(ReplayBufferTest, TestMMapHeaderMismatch) {
+	using Replay = MMapReplayBuffer<torch::kCPU, WorkerBatch, WorkerExample>;
+	using CityTileReplay = MMapReplayBuffer<torch::kCPU,
+		DynamicBatch<torch::kCPU, BoardConfig::size, CityTileModelConfig>,
+		Transition<torch::kCPU, BoardConfig::size, CityTileModelConfig>>;
+	const std::string path = "replay_buffer_test_mismatch.mmap";
+	std::remove(path.c_str());
+	const unsigned capacity = 16, batch_size = 4;
+	WorkerBatch pushed(6);
+	markBatch(pushed, 6, 1);
+	const auto fill = [&] {
+		Replay replay(capacity, batch_size, .6f, .4f, 1000, path);
+		replay.push(pushed, 6);
+	};
+
+	// another capacity
+	fill();
+	{
+		Replay resized(2 * capacity, batch_size, .6f, .4f, 1000, path);
+		ASSERT_EQ(resized.size(), 0);
+		ASSERT_EQ(resized.getPos(), 0);
+	}
+
+	// other feature sizes
+	fill();
+	{
+		CityTileReplay other(capacity, batch_size, .6f, .4f, 1000, path);
+		ASSERT_EQ(other.size(), 0);
+	}
+
+	// same layout, foreign magic
+	fill();
+	{
+		FILE *file = std::fopen(path.c_str(), "r+b");
+		ASSERT_NE(file, nullptr);
+		const uint64_t magic = 0;
+		std::fwrite(&magic, sizeof(magic), 1, file);
+		std::fclose(file);
+		Replay stale(capacity, batch_size, .6f, .4f, 1000, path);
+		ASSERT_EQ(stale.size(), 0);
+	}
+
+	// and an intact file is restored
+	fill();
+	{
+		Replay restored(capacity, batch_size, .6f, .4f, 1000, path);
+		ASSERT_EQ(restored.size(), 6);
+	}
+	std::remove(path.c_str());
+}
+
+TEST(ReplayBufferTest, TestMMapCheckpoint) {
+	using Replay = MMapReplayBuffer<torch::kCPU, WorkerBatch, WorkerExample>;
+	const std::string path = "replay_buffer_test_checkpoint.mmap";
+	std::remove(path.c_str());
+	const unsigned capacity = 16, batch_size = 4;
+	Replay replay(capacity, batch_size, .6f, .4f, 1000, path);
+	WorkerBatch pushed(6);
+	markBatch(pushed, 6, 1);
+	replay.push(pushed, 6);
+	Eigen::ArrayXi choices(batch_size);
+	choices << 0, 1, 2, 3;
+	replay.updatePrios(torch::tensor({.5f, 2.f, 3.f, 4.f}), choices);
+	const Eigen::ArrayXf prios = replay.getPrios();
+
+	std::stringstream stream;
+	{
+		torch::serialize::OutputArchive archive;
+		replay.save(archive);
+		archive.save_to(stream);
+	}
+
+	// the file moves on after the checkpoint, overwriting the first rows
+	WorkerBatch more(12);
+	markBatch(more, 12, 100);
+	replay.push(more, 12);
+	replay.updatePrios(torch::tensor({9.f, 9.f, 9.f, 9.f}), choices);
+	ASSERT_EQ(replay.size(), capacity);
+
+	{
+		torch::serialize::InputArchive archive;
+		archive.load_from(stream);
+		replay.load(archive);
+	}
+	ASSERT_EQ(replay.size(), 6);
+	ASSERT_EQ(replay.getPos(), 6);
+	ASSERT_TRUE(replay.getPrios().isApprox(prios));
+	WorkerBatch sampled(batch_size);
+	for (int draw = 0; draw < 8; ++draw) {
+		replay.sampleInto(TestRandomEngine::getInstance(), 0, sampled, choices);
+		for (unsigned i = 0; i < batch_size; ++i) {
+			ASSERT_FLOAT_EQ(sampled.m_reward[i].item<float>(), choices(i) + 1.f);
+		}
+		expectWholeRows(sampled, batch_size);
+	}
+	std::remove(path.c_str());
+}
+
+TEST(ReplayBufferTest, TestPrefetchUpdatesBeforeDraw) {
+	constexpr std::size_t prefetch_count = 2;
+	const unsigned batch_size = 4;
+	PrefetchSampler<RecordingReplay, RecordingReplay::Batch, TestRandomEngine,
+		prefetch_count> sampler(batch_size);
+	const auto prios = torch::ones({batch_size});
+	for (int step = 0; step < 32; ++step) {
+		const auto &batch = sampler.sample(TestRandomEngine::getInstance(), step);
+		ASSERT_EQ(batch.m_draw, step);
+		// at most prefetch_count draws were in flight when the last updates
+		// arrived, everything before was applied in order ahead of the draw
+		ASSERT_GE(batch.m_updates_seen, step - static_cast<int>(prefetch_count));
+		ASSERT_EQ(batch.m_last_update, batch.m_updates_seen - 1);
+		sampler.updatePrios(prios);
+	}
+}
+
+TEST(ReplayBufferTest, TestPrefetchShutdown) {
+	using Sampler = PrefetchSampler<RecordingReplay, RecordingReplay::Batch,
+		TestRandomEngine, 2>;
+	// hangs on failure
+	{
+		// the worker waits for the first sample
+		Sampler idle(4);
+	}
+	{
+		// the worker filled every slot and waits for one to be freed
+		Sampler full(4);
+		full.sample(TestRandomEngine::getInstance(), 0);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+}
+
+TEST(ReplayBufferTest, BenchmarkPrefetch) {
+	using Replay = ReplayBuffer<torch::kCPU, WorkerBatch, WorkerExample>;
+	using Learner = ModelLearner<BigDQN, torch::kCPU,
+		static_cast<std::size_t>(WorkerActions::Count)>;
+	const unsigned capacity = 4096, steps = 100;
+	WorkerBatch pushed(capacity);
+	markBatch(pushed, capacity, 0);
+
+	const auto steps_per_second = [&](auto &replay_) {
+		replay_.push(pushed, capacity);
+		torch::manual_seed(0);
+		BigDQN dqn(WorkerModelConfig::channels, BoardConfig::size,
+			static_cast<uint64_t>(WorkerActions::Count), HyperParameters::m_nn_std_init,
+			HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+			HyperParameters::m_nn_v_max);
+		Learner learner(dqn, unsigned(WorkerModelConfig::channels), unsigned(BoardConfig::size),
+			static_cast<uint64_t>(WorkerActions::Count), HyperParameters::m_nn_std_init,
+			HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+			HyperParameters::m_nn_v_max);
+		auto &random_engine = TestRandomEngine::getInstance();
+		learner.train(0, replay_, random_engine);
+		const auto start = std::chrono::steady_clock::now();
+		for (unsigned step = 1; step <= steps; ++step) {
+			learner.train(step, replay_, random_engine);
+		}
+		const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+		return steps / elapsed.count();
+	};
+
+	Replay replay(capacity, HyperParameters::m_replay_batch_size, HyperParameters::m_replay_alpha,
+		HyperParameters::m_replay_beta, HyperParameters::m_replay_beta_decay);
+	const double synchronous = steps_per_second(replay);
+	// the sampler thread draws from its own engine
+	PrefetchSampler<Replay, WorkerBatch, RandomEngine<float, 12>, 2> prefetch(capacity,
+		HyperParameters::m_replay_batch_size, HyperParameters::m_replay_alpha,
+		HyperParameters::m_replay_beta, HyperParameters::m_replay_beta_decay);
+	const double prefetched = steps_per_second(prefetch);
+	std::cout << "learner steps/s synchronous: " << synchronous
+		<< " prefetch: " << prefetched << std::endl;
+}
+
+TEST(ReplayBufferTest, TestShardedConcurrentPush) {
+	constexpr std::size_t shard_count = 4;
+	using Replay = ShardedReplayBuffer<torch::kCPU, WorkerBatch, WorkerExample, shard_count>;
+	// room for every push in any one shard, so nothing is overwritten however
+	// the writers spread out
+	const unsigned shard_capacity = 64, batch_size = 16;
+	const unsigned thread_count = 4, pushes = 4, rows = 4;
+	const unsigned pushed_count = thread_count * pushes * rows;
+	Replay replay(shard_count * shard_capacity, batch_size, 1.f, .4f, 1000);
+
+	std::vector<std::thread> writers;
+	for (unsigned t = 0; t < thread_count; ++t) {
+		writers.emplace_back([&replay, t] {
+			WorkerBatch batch(rows);
+			for (unsigned k = 0; k < pushes; ++k) {
+				markBatch(batch, rows, 1 + (t * pushes + k) * rows);
+				replay.push(batch, rows);
+			}
+		});
+	}
+	for (auto &writer : writers) {
+		writer.join();
+	}
+	ASSERT_EQ(replay.size(), pushed_count);
+	ASSERT_FALSE(replay.isCapacityReached());
+
+	// every choice decodes to one stored transition, and no two choices to
+	// the same one
+	auto &random_engine = TestRandomEngine::getInstance();
+	WorkerBatch sampled(batch_size);
+	Eigen::ArrayXi choices(batch_size);
+	std::map<int, float> marker_of;
+	std::map<float, int> choice_of;
+	bool is_spread = false;
+	for (int draw = 0; draw < 32; ++draw) {
+		replay.sampleInto(random_engine, 0, sampled, choices);
+		expectWholeRows(sampled, batch_size);
+		for (unsigned i = 0; i < batch_size; ++i) {
+			const float marker = sampled.m_reward[i].item<float>();
+			ASSERT_GE(marker, 1.f);
+			ASSERT_LE(marker, static_cast<float>(pushed_count));
+			ASSERT_GE(choices(i), 0);
+			ASSERT_LT(choices(i), static_cast<int>(shard_count * shard_capacity));
+			ASSERT_EQ(marker_of.emplace(choices(i), marker).first->second, marker);
+			ASSERT_EQ(choice_of.emplace(marker, choices(i)).first->second, choices(i));
+			is_spread |= choices(i) / shard_capacity != choices(0) / shard_capacity;
+		}
+	}
+	ASSERT_TRUE(is_spread);
+
+	// a priority update routes back to the shard the choice came from
+	const auto target = std::find_if(marker_of.begin(), marker_of.end(),
+		[&](const auto &_entry) { return _entry.first / shard_capacity != 0; });
+	ASSERT_NE(target, marker_of.end());
+	replay.sampleInto(random_engine, 0, sampled, choices);
+	choices(0) = target->first;
+	auto prios = torch::ones({batch_size});
+	for (unsigned i = 0; i < batch_size; ++i) {
+		if (choices(i) == target->first) {
+			prios[i] = 1e4f;
+		}
+	}
+	replay.updatePrios(prios, choices);
+	replay.sampleInto(random_engine, 0, sampled, choices);
+	ASSERT_GE((choices == target->first).count(), batch_size * 3 / 4);
+	for (unsigned i = 0; i < batch_size; ++i) {
+		if (choices(i) == target->first) {
+			ASSERT_FLOAT_EQ(sampled.m_reward[i].item<float>(), target->second);
+		}
+	}
+
+	// a restored buffer draws the same transitions from the same state
+	std::stringstream stream;
+	{
+		torch::serialize::OutputArchive archive;
+		replay.save(archive);
+		archive.save_to(stream);
+	}
+	Replay restored(shard_count * shard_capacity, batch_size, 1.f, .4f, 1000);
+	{
+		torch::serialize::InputArchive archive;
+		archive.load_from(stream);
+		restored.load(archive);
+	}
+	ASSERT_EQ(restored.size(), pushed_count);
+	WorkerBatch restored_sampled(batch_size);
+	Eigen::ArrayXi restored_choices(batch_size);
+	for (int draw = 0; draw < 8; ++draw) {
+		const std::string state = random_engine.getState();
+		replay.sampleInto(random_engine, 0, sampled, choices);
+		random_engine.setState(state);
+		restored.sampleInto(random_engine, 0, restored_sampled, restored_choices);
+		ASSERT_TRUE((choices == restored_choices).all());
+		ASSERT_TRUE(torch::equal(sampled.m_reward, restored_sampled.m_reward));
+		ASSERT_TRUE(torch::equal(sampled.m_weights, restored_sampled.m_weights));
+		expectWholeRows(restored_sampled, batch_size);
+	}
+}
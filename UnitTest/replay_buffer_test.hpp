@@ -0,0 +1,27 @@
+#ifndef REPLAY_BUFFER_TEST_HPP
+#define REPLAY_BUFFER_TEST_HPP
+
+#include "gtest/gtest.h"
+#include "actions.hpp"
+#include "board_config.hpp"
+#include "data_objects.hpp"
+#include "dqn.hpp"
+#include "hyper_parameters.hpp"
+#include "mmap_replay_buffer.hpp"
+#include "model_config.hpp"
+#include "model_learner.hpp"
+#include "prefetch_sampler.hpp"
+#include "random_engine.hpp"
+#include "replay_buffer.hpp"
+#include "sharded_replay_buffer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+#endif /* REPLAY_BUFFER_TEST_HPP */
@@ -8,16 +8,31 @@
 #ifndef ACTOR_HPP_
 #define ACTOR_HPP_
 
+#include <array>
 #include <chrono>
 #include <cmath>
 #include <random>
 #include <type_traits>
 #include "actions.hpp"
+#include "conflict_resolver.hpp"
+#include "dqn.hpp"
 #include "replay_buffer.hpp"
 #include "feature_builder.hpp"
 #include "model_config.hpp"
 #include "pawn_types.hpp"
 
+// actions that did not come from a masked argmax (exploration) fall back to
+// center when the unit's legal bitmask excludes them
+static inline void restrict_to_legal(const torch::Tensor &_legal,
+                                     Eigen::Ref<Eigen::ArrayXi> actions_) {
+  auto legal = _legal.accessor<int64_t, 1>();
+  for (int i = 0; i < actions_.size(); ++i) {
+    if (!((legal[i] >> actions_(i)) & 1)) {
+      actions_(i) = WorkerActionInt::center;
+    }
+  }
+}
+
 template <typename Mask, typename RandomEngine>
 static inline void
 override_actions_by_choice(std::true_type, RandomEngine &random_engine_,
@@ -108,24 +123,25 @@ static inline void limit_actions_by_q(const int _max_allowed,
 }
 
 
-template <std::size_t ActorId, torch::DeviceType DeviceType, typename PawnType,
-          typename RewardEngine, typename ReplayBuf, 
+template <std::size_t ActorId, torch::DeviceType DeviceType, typename BoardConfig,
+          typename PawnType, typename RewardEngine, typename ReplayBuf,
 					typename ModelConfig>
 class MultiStepPawnManager {
 public:
+	static constexpr int max_pawns = BoardConfig::size * BoardConfig::size;
 	using BatchStateFeatures = BatchStateFeature<DeviceType, BoardConfig::size, ModelConfig>;
 	using FinalBatch = DynamicBatch<DeviceType, BoardConfig::size, ModelConfig>;
   MultiStepPawnManager(const std::size_t _multi_step_n, const float _gamma,
                        const std::size_t _batch_size)
       : m_n(_multi_step_n), m_gamma(_gamma), m_batch_size(_batch_size),
         m_retained_id_indices(torch::zeros(
-            {BoardConfig::size * BoardConfig::size}, torch::dtype(torch::kInt64)
-                                                         .requires_grad(false)
-                                                         .device(torch::kCPU))),
+            {max_pawns}, torch::dtype(torch::kInt64)
+                             .requires_grad(false)
+                             .device(torch::kCPU))),
         m_destroyed_id_indices(torch::zeros(
-            {BoardConfig::size * BoardConfig::size}, torch::dtype(torch::kInt64)
-                                                         .requires_grad(false)
-                                                         .device(torch::kCPU))),
+            {max_pawns}, torch::dtype(torch::kInt64)
+                             .requires_grad(false)
+                             .device(torch::kCPU))),
         m_multi_step_pawn_ids(), m_multi_step_actions(),
         m_multi_step_features(), m_multi_step_rewards(_multi_step_n),
 				m_one_step_prior_pawns(),
@@ -172,9 +188,7 @@ public:
 			pushLatestActions(_latest_actions);
 		}
     if (_env.turn > m_n && m_multi_step_pawn_ids.size() == m_n) {
-      std::vector<int> nth_retained_ids_prior;
       const auto &nth_ids_prior = m_multi_step_pawn_ids.front();
-      nth_retained_ids_prior.reserve(nth_ids_prior.size());
 
       m_nth_ids_prior_size = nth_ids_prior.size();
 			if (!m_nth_ids_prior_size) {
@@ -189,8 +203,8 @@ public:
       for (int i = 0; i < nth_ids_prior.size(); ++i) {
         const int id_prior = nth_ids_prior[i];
         if (id_prior == latest_ids[retained_count]) {
+          m_nth_retained_ids_prior[retained_count] = id_prior;
           retained_accessor[retained_count++] = i;
-          nth_retained_ids_prior.push_back(id_prior);
         } else {
           destroyed_accessor[destroyed_count++] = i;
         }
@@ -201,8 +215,7 @@ public:
                                                    retained_count);
       updateFinalBatchNonTerminal(retained_count);
       updateFinalBatchActions(nth_ids_prior.size());
-      updateFinalBatchRewards(_env, nth_retained_ids_prior,
-                              reward_engine_);
+      updateFinalBatchRewards(_env, retained_count, reward_engine_);
 
       m_multi_step_pawn_ids.pop();
     }
@@ -286,12 +299,24 @@ private:
     m_final_batch.m_state.m_geometric.index_put_(
         {up_to_prior_pawn_count},
         nth_features_prior.m_geometric.index({up_to_prior_pawn_count}));
+    m_final_batch.m_state.m_positions.index_put_(
+        {up_to_prior_pawn_count},
+        nth_features_prior.m_positions.index({up_to_prior_pawn_count}));
+    m_final_batch.m_state.m_legal.index_put_(
+        {up_to_prior_pawn_count},
+        nth_features_prior.m_legal.index({up_to_prior_pawn_count}));
 
 		const auto& latest_features = m_multi_step_features.back();
  
     m_final_batch.m_next_state.m_geometric.index_put_(
         {m_retained_id_indices.index({up_to_retained})},
         latest_features.m_geometric.index({up_to_retained}));
+    m_final_batch.m_next_state.m_positions.index_put_(
+        {m_retained_id_indices.index({up_to_retained})},
+        latest_features.m_positions.index({up_to_retained}));
+    m_final_batch.m_next_state.m_legal.index_put_(
+        {m_retained_id_indices.index({up_to_retained})},
+        latest_features.m_legal.index({up_to_retained}));
 
     // pop at end to avoid invalidating the reference
 		// only pop when queue is 1 size greater
@@ -315,9 +340,9 @@ private:
     m_multi_step_actions.pop();
   }
 
+  // the first _retained_count entries of m_nth_retained_ids_prior
   template <typename Env>
-  void updateFinalBatchRewards(const Env &_env,
-                               const std::vector<int> &_nth_retained_ids_prior,
+  void updateFinalBatchRewards(const Env &_env, const int _retained_count,
                                RewardEngine &reward_engine_) {
 		// copy ctor called here
     auto cumulative_rewards_map = m_multi_step_rewards[m_nth_rewards_prior_cursor];
@@ -329,7 +354,10 @@ private:
 		std::cout << std::endl;
 
 
-		for (auto id : _nth_retained_ids_prior) {
+		const auto retained_ids_begin = m_nth_retained_ids_prior.cbegin();
+		const auto retained_ids_end = retained_ids_begin + _retained_count;
+		for (auto it = retained_ids_begin; it != retained_ids_end; ++it) {
+			const int id = *it;
 			if (cumulative_rewards_map.find(id) == cumulative_rewards_map.end()) { // doesn't contain
 				cumulative_rewards_map.insert({id, 0});
 			}
@@ -356,11 +384,11 @@ private:
     auto retained_accessor = m_retained_id_indices.accessor<int64_t, 1>();
 
 		std::cout << "nth retained ids prior: ";
-		for (auto i : _nth_retained_ids_prior) std::cout << i << ",";
+		for (auto it = retained_ids_begin; it != retained_ids_end; ++it) std::cout << *it << ",";
 		std::cout << std::endl;
-    for (int i = 0; i < _nth_retained_ids_prior.size(); ++i) {
+    for (int i = 0; i < _retained_count; ++i) {
       m_final_batch.m_reward.index_put_(
-          {i}, cumulative_rewards_map.at(_nth_retained_ids_prior[i]));
+          {i}, cumulative_rewards_map.at(m_nth_retained_ids_prior[i]));
     }
   }
 
@@ -372,6 +400,7 @@ private:
 
   torch::Tensor m_retained_id_indices;
   torch::Tensor m_destroyed_id_indices;
+  std::array<int, max_pawns> m_nth_retained_ids_prior;
 
   std::queue<std::vector<int>> m_multi_step_pawn_ids;
   std::queue<torch::Tensor> m_multi_step_actions;
@@ -396,6 +425,15 @@ template <std::size_t ActorId, torch::DeviceType DeviceType,
           typename CityTileReplayBuffer, typename RandomEngine>
 class Actor {
 public:
+  // per pawn scratch is sized for a full board at compile time and lives
+  // inline in the actor; heads of it are handed out as Eigen::Ref
+  static constexpr int max_pawns = BoardConfig::size * BoardConfig::size;
+  using PawnActions = Eigen::Array<int, max_pawns, 1>;
+  using WorkerActionCounts =
+      Eigen::Array<float, static_cast<int>(WorkerModelConfig::output_size), 1>;
+  using CityTileActionCounts =
+      Eigen::Array<float, static_cast<int>(CityTileModelConfig::output_size), 1>;
+
   Actor(const float _epsilon_decay, const float _epsilon_start,
         const float _epsilon_end, const std::size_t _atom_count,
         const float _v_min, const float _v_max, const std::size_t _multi_step_n,
@@ -403,22 +441,20 @@ public:
       : m_epsilon_decay(_epsilon_decay), m_epsilon_start(_epsilon_start),
         m_epsilon_end(_epsilon_end), m_episodes(0), m_prior_worker_count(0),
         m_prior_citytile_count(0), m_multi_step_n(_multi_step_n),
-        m_best_worker_actions(BoardConfig::size * BoardConfig::size),
-        m_best_citytile_actions(BoardConfig::size * BoardConfig::size),
-        m_cumsum(BoardConfig::size * BoardConfig::size),
-        m_new_random_actions(BoardConfig::size * BoardConfig::size),
-        m_worker_action_recorder(
-            Eigen::ArrayXf::Ones(WorkerModelConfig::output_size)),
-        m_citytile_action_recorder(
-            Eigen::ArrayXf::Ones(CityTileModelConfig::output_size)),
+        m_best_worker_actions(PawnActions::Zero()),
+        m_best_citytile_actions(PawnActions::Zero()),
+        m_cumsum(PawnActions::Zero()),
+        m_new_random_actions(PawnActions::Zero()),
+        m_worker_action_recorder(WorkerActionCounts::Ones()),
+        m_citytile_action_recorder(CityTileActionCounts::Ones()),
         m_prior_worker_actions(torch::zeros(
-            {BoardConfig::size * BoardConfig::size}, torch::dtype(torch::kInt32)
-                                                         .requires_grad(false)
-                                                         .device(torch::kCPU))),
+            {max_pawns}, torch::dtype(torch::kInt32)
+                             .requires_grad(false)
+                             .device(torch::kCPU))),
         m_prior_citytile_actions(torch::zeros(
-            {BoardConfig::size * BoardConfig::size}, torch::dtype(torch::kInt32)
-                                                         .requires_grad(false)
-                                                         .device(torch::kCPU))),
+            {max_pawns}, torch::dtype(torch::kInt32)
+                             .requires_grad(false)
+                             .device(torch::kCPU))),
         m_support(torch::linspace(_v_min, _v_max, _atom_count,
                                   torch::dtype(torch::kFloat32)
                                       .requires_grad(false)
@@ -469,8 +505,8 @@ public:
       if (any_workers) {
 //        std::cout << "m_worker_action_recorder" << std::endl;
 //        std::cout << m_worker_action_recorder << std::endl;
-        Eigen::ArrayXf probs = (m_worker_action_recorder.sum() -
-                                m_worker_action_recorder.head(5));
+        Eigen::Array<float, 5, 1> probs = (m_worker_action_recorder.sum() -
+                                           m_worker_action_recorder.template head<5>());
 				probs *= probs;
         probs /= probs.sum();
 				
@@ -488,11 +524,12 @@ public:
 //            m_cumsum.head(latest_worker_count),
 //            m_new_random_actions.head(latest_worker_count),
 //            m_best_worker_actions.head(latest_worker_count));
-				Worker::clean_actions(_env, m_best_worker_actions.head(latest_worker_count));
+				restrict_to_legal(m_worker_pawn_manager.getLatestStateFeatures().m_legal,
+				                  m_best_worker_actions.head(latest_worker_count));
       }
 
       if (any_citytiles) {
-	m_best_citytile_actions(0) = 0;
+	m_best_citytile_actions.head(latest_citytile_count) = 0;
 //        Eigen::ArrayXf probs = (m_citytile_action_recorder.sum() -
 //                                m_citytile_action_recorder);
 //				probs *= probs;
@@ -518,16 +555,28 @@ public:
 
 				const auto& state_features = m_worker_pawn_manager.getLatestStateFeatures();
 
-				torch::Tensor q_distribution = dynamic_worker_model_.forward(
-            state_features.m_geometric.index({slice}));
+				torch::Tensor q_distribution;
+				if constexpr (is_board_model<WorkerDQN>::value) {
+					// every row holds the same board, one forward serves all units
+					q_distribution = dynamic_worker_model_.forward(
+							state_features.m_geometric.index({torch::indexing::Slice(0, 1, 1)}),
+							state_features.m_positions.index({slice}));
+				} else {
+					q_distribution = dynamic_worker_model_.forward(
+							state_features.m_geometric.index({slice}));
+				}
 
         torch::Tensor q_projected_dist = q_distribution * m_support;
 
         torch::Tensor q_current = q_projected_dist.sum(2).cpu();
 
-        torch::Tensor argmax = std::get<1>(q_current.max(1));
-
-        tensor_to_eigen<int64_t>(argmax, m_best_worker_actions);
+        const auto legal = expand_action_mask(
+            state_features.m_legal.index({slice}), WorkerModelConfig::output_size);
+        // ranked legal actions, reassigned where units would collide
+        const auto ranked = masked_topk(q_current, legal.cpu(),
+                                        static_cast<int64_t>(WorkerActions::Count));
+        m_conflict_resolver.resolve(_env, std::get<0>(ranked), std::get<1>(ranked),
+                                    m_best_worker_actions.head(latest_worker_count));
 //        const int max_citytiles_allowed =
 //            latest_citytile_count == 0 ? 1 : 0;
 //
@@ -535,7 +584,6 @@ public:
 //            max_citytiles_allowed, static_cast<int>(WorkerActions::BUILD),
 //            m_cumsum.head(latest_worker_count),
 //            m_best_worker_actions.head(latest_worker_count), q_current);
-				Worker::clean_actions(_env, m_best_worker_actions.head(latest_worker_count));
         std::cout << "ACTOR Q current: " << std::endl;
         std::cout << q_current << std::endl;
       }
@@ -570,6 +618,30 @@ public:
     return m_best_citytile_actions.head(m_prior_citytile_count);
   }
 
+  // epsilon schedule and action counts; multi step state is per game and
+  // empty after resetState
+  void save(torch::serialize::OutputArchive &archive_) const {
+    archive_.write("episodes", torch::tensor(static_cast<int64_t>(m_episodes)));
+    archive_.write("worker_action_recorder",
+                   torch::from_blob(const_cast<float *>(m_worker_action_recorder.data()),
+                                    {m_worker_action_recorder.size()})
+                       .clone());
+    archive_.write("citytile_action_recorder",
+                   torch::from_blob(const_cast<float *>(m_citytile_action_recorder.data()),
+                                    {m_citytile_action_recorder.size()})
+                       .clone());
+  }
+
+  void load(torch::serialize::InputArchive &archive_) {
+    torch::Tensor episodes, worker_action_recorder, citytile_action_recorder;
+    archive_.read("episodes", episodes);
+    archive_.read("worker_action_recorder", worker_action_recorder);
+    archive_.read("citytile_action_recorder", citytile_action_recorder);
+    m_episodes = episodes.item<int64_t>();
+    tensor_to_eigen<float>(worker_action_recorder, m_worker_action_recorder);
+    tensor_to_eigen<float>(citytile_action_recorder, m_citytile_action_recorder);
+  }
+
   inline void resetState() {
 		m_worker_pawn_manager.resetState();
     m_prior_worker_count = 0;
@@ -587,20 +659,21 @@ private:
   std::size_t m_prior_citytile_count;
   std::size_t m_multi_step_n;
 
-  // TODO: size known at compile time
-  Eigen::ArrayXi m_best_worker_actions;
-  Eigen::ArrayXi m_best_citytile_actions;
-  Eigen::ArrayXi m_cumsum;
-  Eigen::ArrayXi m_new_random_actions;
-  Eigen::ArrayXf m_worker_action_recorder;
-  Eigen::ArrayXf m_citytile_action_recorder;
+  PawnActions m_best_worker_actions;
+  PawnActions m_best_citytile_actions;
+  PawnActions m_cumsum;
+  PawnActions m_new_random_actions;
+  WorkerActionCounts m_worker_action_recorder;
+  CityTileActionCounts m_citytile_action_recorder;
 
   torch::Tensor m_prior_worker_actions;
   torch::Tensor m_prior_citytile_actions;
 
   torch::Tensor m_support;
+  ConflictResolver<BoardConfig> m_conflict_resolver;
 
-  MultiStepPawnManager<ActorId, DeviceType, Worker, WorkerRewardEngine, WorkerReplayBuffer, WorkerModelConfig>
+  MultiStepPawnManager<ActorId, DeviceType, BoardConfig, Worker, WorkerRewardEngine,
+                       WorkerReplayBuffer, WorkerModelConfig>
       m_worker_pawn_manager;
 };
 
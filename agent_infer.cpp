@@ -0,0 +1,181 @@
+#include <sys/resource.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include "lux/kit.hpp"
+#include "lux/define.cpp"
+#include "actions.hpp"
+#include "agent_io.hpp"
+#include "board_config.hpp"
+#include "checkpoint.hpp"
+#include "dqn.hpp"
+#include "feature_builder.hpp"
+#include "frozen_module.hpp"
+#include "heuristic_policy.hpp"
+#include "hyper_parameters.hpp"
+#include "inference_agent.hpp"
+#include "model_config.hpp"
+#include "model_registry.hpp"
+#include "quantized_dqn.hpp"
+#include "train_config.hpp"
+#include "turn_scheduler.hpp"
+
+static_assert(!TrainConfig::quantized_inference ||
+		TrainConfig::device == torch::kCPU,
+	"quantized_inference runs fbgemm int8 kernels, CPU only");
+
+// QuantizedBigDQN together with the float model whose trunk it runs, built
+// from the eager weights Trainer::checkpoint writes to worker_weights_path
+template <typename Board> class DeployedQuantizedDQN {
+public:
+	explicit DeployedQuantizedDQN(const std::string &_path)
+			: m_model(WorkerModelConfig::channels, Board::size,
+				static_cast<uint64_t>(WorkerActions::Count), HyperParameters::m_nn_std_init,
+				HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+				HyperParameters::m_nn_v_max),
+			  m_quantized(load(m_model, _path)) {}
+
+	inline torch::Tensor forward(torch::Tensor geometric) {
+		return m_quantized.forward(geometric);
+	}
+
+private:
+	static BigDQN &load(BigDQN &model_, const std::string &_path) {
+		if constexpr (TrainConfig::channels_last) {
+			model_.toChannelsLast();
+		}
+		torch::serialize::InputArchive archive;
+		archive.load_from(_path);
+		load_module_state(archive, model_);
+		model_.eval();
+		return model_;
+	}
+
+	BigDQN m_model;
+	QuantizedBigDQN m_quantized;
+};
+
+// only BigDQN has an int8 variant, other models play frozen
+template <typename WorkerDQN>
+constexpr bool plays_quantized =
+	TrainConfig::quantized_inference && std::is_same<WorkerDQN, BigDQN>::value;
+
+// Play only: loads a frozen worker checkpoint, or with
+// TrainConfig::quantized_inference the eager BigDQN weights quantized to int8,
+// and acts greedily. No learner, target network, optimizer or replay is ever
+// built. With TrainConfig::turn_deadline a turn whose inference would not
+// finish in time is played by HeuristicPolicy instead.
+template <typename WorkerDQN, typename Board>
+using Agent = InferenceAgent<
+	std::conditional_t<plays_quantized<WorkerDQN>, DeployedQuantizedDQN<Board>,
+		FrozenModule<WorkerDQN, TrainConfig::device>>,
+	std::conditional_t<is_board_model<WorkerDQN>::value, BoardFeatureBuilder,
+		WorkerFeatureBuilder>,
+	TrainConfig::device, Board>;
+
+// the policies of one map size; the checkpoint, exported per size, is
+// loaded when a game of that size first starts
+template <typename WorkerDQN> struct SizedPlay {
+	template <typename Board> struct Policies {
+		std::unique_ptr<Agent<WorkerDQN, Board>> m_inference;
+		HeuristicPolicy<Board> m_heuristic;
+	};
+	using Runs = BoardSizes::tuple_t<Policies>;
+};
+
+static inline long peak_rss_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+template <typename WorkerDQN>
+static void play(char *membuf, const std::string &_checkpoint,
+		const std::chrono::steady_clock::time_point _started) {
+		kit::Agent agent = kit::Agent();
+		typename SizedPlay<WorkerDQN>::Runs runs;
+		const auto policies_for = [&](auto board_tag) -> auto & {
+			using Board = typename decltype(board_tag)::type;
+			auto &policies = std::get<
+				typename SizedPlay<WorkerDQN>::template Policies<Board>>(runs);
+			if (!policies.m_inference) {
+				const auto path = board_path<Board>(!_checkpoint.empty() ? _checkpoint
+					: plays_quantized<WorkerDQN> ? TrainConfig::worker_weights_path
+					: TrainConfig::worker_checkpoint_path);
+				policies.m_inference = std::make_unique<Agent<WorkerDQN, Board>>(path);
+				std::cout << "loaded " << path << " in "
+					<< std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - _started).count()
+					<< " ms, peak rss " << peak_rss_kb() << " kB" << std::endl;
+			}
+			return policies;
+		};
+		// the default size loads up front, others on their first game
+		policies_for(board_tag<BoardConfig::size>{});
+		TurnScheduler turn(TrainConfig::turn_limit_ms, TrainConfig::turn_overage_ms,
+			TrainConfig::turn_safety_ms, TrainConfig::turn_deadline);
+
+		bool is_first_action = true;
+		while (!wait_for_next_msg(membuf)) {}
+		while (true) {
+			turn.startGame();
+			initialize_game(agent, membuf);
+			const bool found = BoardSizes::dispatch(agent.mapWidth, [&](auto board_tag) {
+				using Board = typename decltype(board_tag)::type;
+				auto &policies = policies_for(board_tag);
+				while (!wait_for_next_msg(membuf)) {
+					turn.startTurn(Board::episode_steps - 1 - agent.turn);
+					agent.updateServer(membuf);
+					// may draw on the overage bank, the heuristic is only a stopgap
+					const bool inferred = turn.run(TurnStage::Inference, [&] {
+						send_actions(agent, policies.m_inference->act(agent), membuf);
+					}, true);
+					if (!inferred) {
+						send_actions(agent, policies.m_heuristic.act(agent), membuf);
+					}
+					turn.endTurn();
+					if (is_first_action) {
+						std::cout << "time to first action "
+							<< std::chrono::duration<double, std::milli>(
+								std::chrono::steady_clock::now() - _started).count()
+							<< " ms, peak rss " << peak_rss_kb() << " kB" << std::endl;
+						is_first_action = false;
+					}
+					wait_for_client_to_forward_actions(membuf);
+				}
+			});
+			if (!found) {
+				std::cerr << "unsupported map size " << agent.mapWidth
+					<< ", expected one of " << BoardSizes::names() << std::endl;
+				exit(1);
+			}
+		}
+}
+
+int main(int argc, char **argv) {
+		const auto started = std::chrono::steady_clock::now();
+		// empty picks the default for the model, frozen or eager weights
+		const std::string checkpoint = argc > 1 ? argv[1] : "";
+		// the worker model decides the input features, it must match the one
+		// the checkpoint was exported from
+		const auto models = read_model_selection(TrainConfig::model_config_path,
+			{TrainConfig::worker_model, TrainConfig::citytile_model});
+
+		char *membuf = initialize_memory_map();
+		const bool found = WorkerModelRegistry::dispatch(models.m_worker,
+			[&](auto worker_tag) {
+				using WorkerDQN = typename decltype(worker_tag)::type;
+				if (TrainConfig::quantized_inference && !plays_quantized<WorkerDQN>) {
+					std::cout << "quantized_inference covers BigDQN only, "
+						<< models.m_worker << " plays frozen" << std::endl;
+				}
+				play<WorkerDQN>(membuf, checkpoint, started);
+			});
+		if (!found) {
+			std::cerr << "unknown worker_model " << models.m_worker << std::endl;
+			exit(1);
+		}
+    return 0;
+}
@@ -0,0 +1,213 @@
+#ifndef AGENT_IO_HPP_
+#define AGENT_IO_HPP_
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include "lux/kit.hpp"
+#include "actions.hpp"
+#include "board_config.hpp"
+#include "server.hpp"
+
+// shared memory protocol with the forwarder, used by both the training
+// agent (main) and the inference only agent (agent_infer)
+
+static inline void print_board(const kit::Agent& _env) {
+	std::stringstream ss;
+	const auto& player = _env.players[_env.id];
+	const auto& cities = player.cities;
+		
+	const auto& units = player.units;
+	std::unordered_set<const lux::Cell*> unit_cells;	
+	const auto& map = _env.map;
+
+	for (const auto& unit : units) {
+		unit_cells.insert(map.getCellByPos(unit.pos));
+	}
+	
+	ss << "E: " << _env.turn << " F: " << player.getFuel() << " WC: " << player.getWoodCargo() << " U: " << units.size() << " CT: " << player.cityTileCount << " RP: " << player.researchPoints << std::endl;
+	for (int y = 0; y < map.height; ++y) {
+		for (int x = 0; x < map.width; ++x) {
+			ss << "|";
+			const auto& cell = map.getCell(x,y);
+			if (unit_cells.find(cell) != unit_cells.end()) {
+				ss << "a";		
+			} else {
+				ss << " ";
+			}			
+			if (cell->hasResource()) {
+				if (cell->resource.type==lux::ResourceType::wood) {
+					ss << 1;
+				} else if (cell->resource.type==lux::ResourceType::coal) { 
+					ss << 2;
+				} else {
+					ss << 3;
+				}
+			} else {
+				ss << 0;
+			}
+
+			if (cell->citytile != nullptr && cell->citytile->team==_env.id) {
+				ss << "A";
+			} else {
+				ss << " ";
+			}
+		}
+		ss << "|\n";	
+	}
+	std::cout << ss.str() << std::endl;
+}
+
+
+static inline bool wait_for_next_msg(char * membuf_) {
+	*membuf_ = ack_input_received;
+	while (*membuf_==ack_input_received) {};
+//	std::cout << "server received: " << membuf_ << std::endl;
+	return *membuf_==game_start_key;
+}
+
+static inline void wait_for_client_to_forward_actions(char * membuf_) {
+	while (*membuf_!=ack_actions_forwarded) {};
+}
+
+// as above for actor threads, giving up once _stop is raised; false if
+// stopped
+static inline bool wait_for_next_msg(char * membuf_, const std::atomic<bool>& _stop,
+		bool& is_new_game_) {
+	*membuf_ = ack_input_received;
+	while (*membuf_==ack_input_received) {
+		if (_stop.load(std::memory_order_relaxed)) return false;
+	}
+	is_new_game_ = *membuf_==game_start_key;
+	return true;
+}
+
+static inline bool wait_for_client_to_forward_actions(char * membuf_,
+		const std::atomic<bool>& _stop) {
+	while (*membuf_!=ack_actions_forwarded) {
+		if (_stop.load(std::memory_order_relaxed)) return false;
+	}
+	return true;
+}
+
+static inline void initialize_game(kit::Agent& agent_, char * membuf_) {
+	membuf_++; // game_start_key first
+	agent_.id = *membuf_ - '0';
+	membuf_++; // assumes agent id single digit
+	std::string map_info(membuf_);
+	std::vector<std::string> map_parts = kit::tokenize(map_info, " ");
+	agent_.mapWidth = std::stoi(map_parts[0]);
+	agent_.mapHeight = std::stoi(map_parts[1]);
+	agent_.map = lux::GameMap(agent_.mapWidth, agent_.mapHeight);
+	agent_.turn = 0;
+	std::cout << "initialized game: id " << agent_.id << ", " << agent_.mapWidth << ", " << agent_.mapHeight << std::endl;
+}
+
+template<typename ActionReturn>
+static inline void send_actions(
+	const kit::Agent& _agent, const ActionReturn& _actions, char * membuf_) {
+	std::stringstream ss;
+	ss << ack_inputs_processed;
+
+	const auto worker_actions = std::get<0>(_actions);
+	const auto ctile_actions = std::get<1>(_actions);
+	const auto& player = _agent.players[_agent.id];
+	const auto& workers = player.units;
+	const auto&	cities = player.cities;
+
+	// one comma separated list for workers and citytiles, a separator only
+	// goes in front of a command that is actually written
+	bool is_first_command = true;
+	const auto write_command = [&](const std::string& _command) {
+		if (!is_first_command) ss << ",";
+		ss << _command;
+		is_first_command = false;
+	};
+  
+	assert(workers.size() == worker_actions.size());
+	for (int i = 0; i < workers.size(); i++) {
+		const auto& unit = workers[i];
+		if (!unit.canAct()) continue;
+		const auto action = static_cast<WorkerActions>(worker_actions(i));
+		switch (action) {
+		case WorkerActions::CENTER:
+			write_command(unit.move(lux::DIRECTIONS::CENTER));
+			break;
+		case WorkerActions::NORTH:
+			write_command(unit.move(lux::DIRECTIONS::NORTH));
+			break;
+		case WorkerActions::EAST:
+			write_command(unit.move(lux::DIRECTIONS::EAST));
+			break;
+		case WorkerActions::SOUTH:
+			write_command(unit.move(lux::DIRECTIONS::SOUTH));
+			break;
+		case WorkerActions::WEST:
+			write_command(unit.move(lux::DIRECTIONS::WEST));
+			break;
+//		case WorkerActions::PILLAGE:
+//			write_command(unit.pillage());
+//			break;
+//		case WorkerActions::TRANSFER:
+//			assert(false);
+//			break;
+		case WorkerActions::BUILD:
+			write_command(unit.buildCity());
+			break;
+		}
+	}
+
+	int ctile_index = 0;
+	for (const auto& kv : cities) {
+		const auto& city = kv.second;
+		for (const auto& ctile : city.citytiles) {
+			// one action per citytile, acting or not, like the workers above
+			const int index = ctile_index++;
+			if (!ctile.canAct() || index >= ctile_actions.size()) continue;
+			const auto action = static_cast<CityTileActions>(ctile_actions(index));
+			switch (action) {
+			case CityTileActions::BUILD_WORKER:
+				write_command(ctile.buildWorker());
+				break;
+//			case CityTileActions::BUILD_CART:
+//				write_command(ctile.buildCart());
+//				break;
+			case CityTileActions::RESEARCH:
+				write_command(ctile.research());
+				break; 
+			}	
+		}
+	}	
+
+	ss << "\nD_FINISH\n";
+	const std::string str(ss.str());
+	const char * cstr = str.c_str();
+	strcpy(membuf_, cstr);
+} 
+
+static char * initialize_memory_map(const key_t _key = key) {
+	int shmid;
+	char *membuf;
+
+	if ((shmid = shmget(_key, buf_size, IPC_CREAT | 0666)) < 0) {
+			perror("shmget");
+			exit(1);
+	}
+
+	if ((membuf = (char *)shmat(shmid, NULL, 0)) == (char *) -1) {
+			perror("shmat");
+			exit(1);
+	}
+	return membuf;
+}
+
+#endif /* AGENT_IO_HPP_ */
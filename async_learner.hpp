@@ -0,0 +1,138 @@
+#ifndef ASYNC_LEARNER_HPP_
+#define ASYNC_LEARNER_HPP_
+
+#include "replay_buffer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// Runs ModelLearner::train on its own thread so SGD steps never sit on the
+// turn response path. The acting thread reports frames through notifyFrame
+// and the learner keeps m_replay_ratio steps per frame once replay is warm.
+// Every m_publish_interval steps the learner publishes its weights to the
+// snapshot that the acting network pulls from between turns.
+//
+// m_max_lag bounds how far the learner may fall behind its step budget
+// before notifyFrame applies backpressure to the actor; 0 never blocks.
+template <typename ModelLearner, typename DQN, typename ReplayBuf,
+          typename Snapshot, typename RandomEngine>
+class AsyncLearner {
+public:
+  AsyncLearner(ModelLearner &learner_, DQN &learner_dqn_,
+               ReplayBuf &replay_buffer_, Snapshot &snapshot_,
+               const std::size_t _warmup_frames, const float _replay_ratio,
+               const std::size_t _publish_interval, const std::size_t _max_lag)
+      : m_learner(learner_), m_learner_dqn(learner_dqn_),
+        m_replay_buffer(replay_buffer_), m_snapshot(snapshot_),
+        m_random_engine(RandomEngine::getInstance()),
+        m_warmup_frames(_warmup_frames), m_replay_ratio(_replay_ratio),
+        m_publish_interval(_publish_interval), m_max_lag(_max_lag), m_frame(0),
+        m_warm_frame(0), m_is_warm(false), m_steps(0), m_stop(false),
+        m_thread(&AsyncLearner::run, this) {}
+
+  AsyncLearner(const AsyncLearner &) = delete;
+  AsyncLearner &operator=(const AsyncLearner &) = delete;
+
+  ~AsyncLearner() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_learner_cv.notify_one();
+    m_thread.join();
+  }
+
+  inline std::size_t getSteps() const {
+    return m_steps.load(std::memory_order_relaxed);
+  }
+
+  void notifyFrame(const std::size_t _frame) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // several actors may report out of order
+    m_frame = std::max(m_frame, _frame);
+    if (!m_is_warm &&
+        is_replay_warm(m_replay_buffer, _frame, m_warmup_frames)) {
+      m_is_warm = true;
+      m_warm_frame = _frame;
+    }
+    m_learner_cv.notify_one();
+    if (m_max_lag > 0) {
+      m_actor_cv.wait(lock, [this] { return m_stop || lag() <= m_max_lag; });
+    }
+  }
+
+  // runs f between learner steps, e.g. to checkpoint a consistent view of
+  // the learner and its replay
+  template <typename F> void withLearnerPaused(F &&f) {
+    std::lock_guard<std::mutex> lock(m_train_mutex);
+    f();
+  }
+
+private:
+  // learner steps owed to the acting thread, caller holds m_mutex
+  inline std::size_t lag() const {
+    if (!m_is_warm) {
+      return 0;
+    }
+    const std::size_t budget = static_cast<std::size_t>(
+        m_replay_ratio * static_cast<float>(m_frame - m_warm_frame + 1));
+    const std::size_t steps = m_steps.load(std::memory_order_relaxed);
+    return budget > steps ? budget - steps : 0;
+  }
+
+  void run() {
+    while (true) {
+      std::size_t frame;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_learner_cv.wait(lock, [this] { return m_stop || lag() > 0; });
+        if (m_stop) {
+          return;
+        }
+        frame = m_frame;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(m_train_mutex);
+        m_learner.train(frame, m_replay_buffer, m_random_engine);
+        const std::size_t steps =
+            m_steps.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (steps % m_publish_interval == 0) {
+          m_snapshot.publish(m_learner_dqn);
+        }
+      }
+      if (m_max_lag > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_actor_cv.notify_one();
+      }
+    }
+  }
+
+private:
+  ModelLearner &m_learner;
+  DQN &m_learner_dqn;
+  ReplayBuf &m_replay_buffer;
+  Snapshot &m_snapshot;
+  RandomEngine &m_random_engine;
+  const std::size_t m_warmup_frames;
+  const float m_replay_ratio;
+  const std::size_t m_publish_interval;
+  const std::size_t m_max_lag;
+
+  std::size_t m_frame;
+  std::size_t m_warm_frame;
+  bool m_is_warm;
+  std::atomic<std::size_t> m_steps;
+  bool m_stop;
+
+  std::mutex m_mutex;
+  std::mutex m_train_mutex;
+  std::condition_variable m_learner_cv;
+  std::condition_variable m_actor_cv;
+  std::thread m_thread;
+};
+
+#endif /* ASYNC_LEARNER_HPP_ */
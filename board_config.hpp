@@ -1,7 +1,18 @@
 #pragma once
 
-struct BoardConfig {
-  static constexpr int size = 12;
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+
+constexpr int default_board_size = 12;
+
+// Everything sized by the board takes its config as a template parameter,
+// so each supported map size is its own instantiation with constexpr
+// dimensions.
+template <int Size> struct SizedBoardConfig {
+  static_assert(Size >= default_board_size, "smaller than any Lux map");
+  static constexpr int size = Size;
   static constexpr int episode_steps = 361;
   static constexpr int actor_count = 1;
 	static constexpr float worker_max_cargo = 100;
@@ -12,4 +23,50 @@ struct BoardConfig {
 	static constexpr float coal_to_fuel = 10;
 	static constexpr float max_uranium_collect = 2;
 	static constexpr float uranium_to_fuel = 40;
+  // keeps the RNG streams of trainers for different sizes apart; zero for
+  // the default size, so single size runs keep their seeds
+  static constexpr uint64_t seed_offset =
+      static_cast<uint64_t>(Size - default_board_size) << 8;
 };
+
+using BoardConfig = SizedBoardConfig<default_board_size>;
+
+// file of one board size: the default size keeps _path, others get _<size>
+// before the extension
+template <typename BoardConfig>
+static inline std::string board_path(const std::string &_path) {
+  if (BoardConfig::size == default_board_size) {
+    return _path;
+  }
+  const auto dot = _path.find_last_of('.');
+  const auto stem = dot == std::string::npos ? _path.size() : dot;
+  return _path.substr(0, stem) + "_" + std::to_string(BoardConfig::size) +
+         _path.substr(stem);
+}
+
+template <int Size> struct board_tag { using type = SizedBoardConfig<Size>; };
+
+// Map sizes compiled in. Like ModelRegistry for architectures, dispatch
+// hands the caller the config for a size only known at runtime.
+template <int... Sizes> struct BoardSizeRegistry {
+  static constexpr std::size_t count = sizeof...(Sizes);
+
+  // one F<SizedBoardConfig<Size>> per size
+  template <template <typename> class F>
+  using tuple_t = std::tuple<F<SizedBoardConfig<Sizes>>...>;
+
+  // calls f(board_tag<Size>{}) for _size, false if it is not compiled in
+  template <typename F> static bool dispatch(const int _size, F &&f) {
+    return ((_size == Sizes && (f(board_tag<Sizes>{}), true)) || ...);
+  }
+
+  static std::string names() {
+    std::string names;
+    ((names += std::string(names.empty() ? "" : ", ") + std::to_string(Sizes)),
+     ...);
+    return names;
+  }
+};
+
+// square Lux maps
+using BoardSizes = BoardSizeRegistry<12, 16, 24, 32>;
@@ -0,0 +1,102 @@
+#ifndef CATEGORICAL_PROJECTION_HPP_
+#define CATEGORICAL_PROJECTION_HPP_
+
+#include <ATen/Parallel.h>
+#include <cmath>
+#include <torch/torch.h>
+
+// Projection of the n-step target distribution r + gamma * z onto the fixed
+// support [v_min, v_max] (C51). distribution_ is [batch, atoms] and is
+// overwritten.
+
+// tensor op version, one kernel launch per op; used off cpu
+static inline void project_categorical_reference(
+    const torch::Tensor &_reward, const torch::Tensor &_is_non_terminal,
+    const torch::Tensor &_probabilities, const torch::Tensor &_support,
+    const torch::Tensor &_offset, const float _gamma, const float _v_min,
+    const float _v_max, torch::Tensor &distribution_) {
+  const int64_t atom_count = _probabilities.size(1);
+  const float delta_z = (_v_max - _v_min) / (atom_count - 1);
+  distribution_.zero_();
+
+  auto Tz = _reward.unsqueeze(1) +
+            _is_non_terminal.unsqueeze(1) * _gamma * _support.unsqueeze(0);
+  Tz.clamp_(_v_min, _v_max);
+
+  torch::Tensor b = (Tz - _v_min) / delta_z;
+  torch::Tensor l = b.floor().to(torch::kInt32);
+  torch::Tensor u = b.ceil().to(torch::kInt32);
+
+  // b on an atom: move l down, or u up when already on the first atom
+  torch::Tensor mask_for_lowers = (u > 0) * (l == u);
+  l.index_put_({mask_for_lowers}, (l - 1).index({mask_for_lowers}));
+  torch::Tensor mask_for_uppers =
+      (l < (static_cast<int>(atom_count) - 1)) * (l == u);
+  u.index_put_({mask_for_uppers}, (u + 1).index({mask_for_uppers}));
+
+  distribution_.view({-1}).index_add_(
+      0, (l + _offset).view({-1}),
+      (_probabilities * (u.to(torch::kFloat32) - b)).view({-1}));
+  distribution_.view({-1}).index_add_(
+      0, (u + _offset).view({-1}),
+      (_probabilities * (b - l.to(torch::kFloat32))).view({-1}));
+}
+
+// fused single pass over the batch for cpu tensors. rows are split across
+// the intra-op pool, the per atom bin computation is vectorized and only the
+// two scatter adds per atom stay scalar.
+static inline void project_categorical(const torch::Tensor &_reward,
+                                       const torch::Tensor &_is_non_terminal,
+                                       const torch::Tensor &_probabilities,
+                                       const float _gamma, const float _v_min,
+                                       const float _v_max,
+                                       torch::Tensor &distribution_) {
+  const int64_t batch_size = _probabilities.size(0);
+  const int atom_count = static_cast<int>(_probabilities.size(1));
+  const float delta_z = (_v_max - _v_min) / (atom_count - 1);
+
+  const auto reward = _reward.to(torch::kFloat32).contiguous();
+  const auto is_non_terminal = _is_non_terminal.to(torch::kBool).contiguous();
+  const auto probabilities = _probabilities.contiguous();
+  const float *reward_p = reward.data_ptr<float>();
+  const bool *is_non_terminal_p = is_non_terminal.data_ptr<bool>();
+  const float *probabilities_p = probabilities.data_ptr<float>();
+  float *distribution_p = distribution_.data_ptr<float>();
+
+  at::parallel_for(0, batch_size, 16, [&](int64_t _begin, int64_t _end) {
+    std::vector<float> b(atom_count);
+    std::vector<int> l(atom_count);
+    std::vector<int> u(atom_count);
+    for (int64_t row = _begin; row < _end; ++row) {
+      const float reward_row = reward_p[row];
+      const float gamma_row = is_non_terminal_p[row] ? _gamma : 0.f;
+      const float *p = probabilities_p + row * atom_count;
+      float *out = distribution_p + row * atom_count;
+
+#pragma omp simd
+      for (int j = 0; j < atom_count; ++j) {
+        const float z = _v_min + j * delta_z;
+        const float Tz =
+            std::min(std::max(reward_row + gamma_row * z, _v_min), _v_max);
+        const float bj = (Tz - _v_min) / delta_z;
+        int lj = static_cast<int>(std::floor(bj));
+        int uj = static_cast<int>(std::ceil(bj));
+        const int same = lj == uj;
+        const int lower = same & (uj > 0);
+        lj -= lower;
+        uj += same & (1 - lower) & (lj < atom_count - 1);
+        b[j] = bj;
+        l[j] = lj;
+        u[j] = uj;
+        out[j] = 0.f;
+      }
+
+      for (int j = 0; j < atom_count; ++j) {
+        out[l[j]] += p[j] * (u[j] - b[j]);
+        out[u[j]] += p[j] * (b[j] - l[j]);
+      }
+    }
+  });
+}
+
+#endif /* CATEGORICAL_PROJECTION_HPP_ */
@@ -0,0 +1,183 @@
+#ifndef CHECKPOINT_HPP_
+#define CHECKPOINT_HPP_
+
+#include <condition_variable>
+#include <cstdio>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <torch/torch.h>
+#include <unistd.h>
+
+// Parameters and buffers by name, cloned so the archive owns a copy taken at
+// the time of the call and later optimizer steps do not leak into it.
+template <typename Model>
+static void save_module_state(torch::serialize::OutputArchive &archive_,
+                              const Model &_model) {
+  torch::NoGradGuard no_grad;
+  for (const auto &kv : _model.named_parameters(true)) {
+    archive_.write(kv.key(), kv.value().detach().to(torch::kCPU, false, true));
+  }
+  for (const auto &kv : _model.named_buffers(true)) {
+    archive_.write(kv.key(), kv.value().detach().to(torch::kCPU, false, true),
+                   true);
+  }
+}
+
+// copies into the existing tensors so optimizer and snapshot views of the
+// parameters stay valid
+template <typename Model>
+static void load_module_state(torch::serialize::InputArchive &archive_,
+                              Model &model_) {
+  torch::NoGradGuard no_grad;
+  torch::Tensor loaded;
+  for (auto &kv : model_.named_parameters(true)) {
+    archive_.read(kv.key(), loaded);
+    kv.value().copy_(loaded);
+  }
+  for (auto &kv : model_.named_buffers(true)) {
+    archive_.read(kv.key(), loaded, true);
+    kv.value().copy_(loaded);
+  }
+}
+
+// SGD momentum buffers keyed by parameter index; the optimizer itself keys
+// them by TensorImpl address, which does not survive a restart
+static void save_sgd_state(torch::serialize::OutputArchive &archive_,
+                           torch::optim::SGD &optimizer_) {
+  torch::NoGradGuard no_grad;
+  const auto &params = optimizer_.param_groups()[0].params();
+  for (std::size_t i = 0; i < params.size(); ++i) {
+    const auto it = optimizer_.state().find(
+        c10::guts::to_string(params[i].unsafeGetTensorImpl()));
+    if (it == optimizer_.state().end()) {
+      continue;
+    }
+    const auto &state =
+        static_cast<const torch::optim::SGDParamState &>(*it->second);
+    if (state.momentum_buffer().defined()) {
+      archive_.write("momentum_" + std::to_string(i),
+                     state.momentum_buffer().to(torch::kCPU, false, true));
+    }
+  }
+}
+
+static void load_sgd_state(torch::serialize::InputArchive &archive_,
+                           torch::optim::SGD &optimizer_) {
+  torch::NoGradGuard no_grad;
+  const auto &params = optimizer_.param_groups()[0].params();
+  for (std::size_t i = 0; i < params.size(); ++i) {
+    torch::Tensor momentum;
+    if (!archive_.try_read("momentum_" + std::to_string(i), momentum)) {
+      continue;
+    }
+    auto state = std::make_unique<torch::optim::SGDParamState>();
+    state->momentum_buffer(momentum.to(params[i].device()));
+    optimizer_.state()[c10::guts::to_string(
+        params[i].unsafeGetTensorImpl())] = std::move(state);
+  }
+}
+
+// Writes checkpoints on a background thread. Each job serializes to
+// path + ".tmp", fsyncs and renames over path, so a reader never sees a
+// partial file. A newer job for a path replaces one still pending, so a
+// slow disk drops stale checkpoints instead of queueing them. Pending jobs
+// are drained on destruction.
+class CheckpointWriter {
+public:
+  using Job = std::function<void(const std::string &)>;
+
+  CheckpointWriter() : m_stop(false), m_thread(&CheckpointWriter::run, this) {}
+
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+  ~CheckpointWriter() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+  }
+
+  void submit(const std::string &_path, Job _job) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pending[_path] = std::move(_job);
+    }
+    m_cv.notify_one();
+  }
+
+  // the archive is moved in, the caller must not touch it afterwards
+  void submit(const std::string &_path,
+              torch::serialize::OutputArchive &&archive_) {
+    auto archive = std::make_shared<torch::serialize::OutputArchive>(
+        std::move(archive_));
+    submit(_path, [archive](const std::string &_tmp) {
+      archive->save_to(_tmp);
+    });
+  }
+
+  // blocks until every submitted job is on disk
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_cv.wait(lock, [this] { return m_pending.empty() && !m_busy; });
+  }
+
+private:
+  void run() {
+    while (true) {
+      std::string path;
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_busy = false;
+        m_idle_cv.notify_all();
+        m_cv.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+        if (m_pending.empty()) {
+          return;
+        }
+        path = m_pending.begin()->first;
+        job = std::move(m_pending.begin()->second);
+        m_pending.erase(m_pending.begin());
+        m_busy = true;
+      }
+      write(path, job);
+    }
+  }
+
+  static void write(const std::string &_path, const Job &_job) {
+    const std::string tmp = _path + ".tmp";
+    try {
+      _job(tmp);
+    } catch (const std::exception &e) {
+      std::cerr << "checkpoint " << _path << " failed: " << e.what()
+                << std::endl;
+      std::remove(tmp.c_str());
+      return;
+    }
+    const int fd = open(tmp.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      fsync(fd);
+      close(fd);
+    }
+    if (std::rename(tmp.c_str(), _path.c_str()) != 0) {
+      perror("rename");
+    }
+  }
+
+  std::map<std::string, Job> m_pending;
+  bool m_busy = true;
+  bool m_stop;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::condition_variable m_idle_cv;
+  std::thread m_thread;
+};
+
+#endif /* CHECKPOINT_HPP_ */
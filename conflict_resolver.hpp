@@ -0,0 +1,136 @@
+#ifndef CONFLICT_RESOLVER_HPP_
+#define CONFLICT_RESOLVER_HPP_
+
+#include "actions.hpp"
+#include "lux/kit.hpp"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <torch/torch.h>
+#include <vector>
+
+// Joint worker moves without collisions. The engine rejects two units ending
+// on the same non-city cell, and a unit moving onto a unit that stays. Units
+// are resolved in order of their best Q value, each taking its highest ranked
+// action whose target cell is still free:
+//  - own citytiles hold any number of units
+//  - opponent units and citytiles block
+//  - a cell claimed by an earlier unit blocks
+//  - a cell whose unit has not been resolved yet blocks; once that unit
+//    commits to leaving the cell frees up
+// A unit always keeps its own cell until it leaves, so center is a safe
+// fallback when every ranked action is taken. O(n log n) for the ordering,
+// then O(n * ranks) bit tests.
+template <typename BoardConfig> class ConflictResolver {
+public:
+  static constexpr int cells = BoardConfig::size * BoardConfig::size;
+
+  ConflictResolver() { m_cells.reserve(cells); m_order.reserve(cells); }
+
+  // _values and _actions are [workers, ranks] from topk over the masked Q
+  // values, rows in feature order; illegal actions carry -inf and are
+  // skipped. actions_ is overwritten with the resolved action per worker
+  void resolve(const kit::Agent &_env, const torch::Tensor &_values,
+               const torch::Tensor &_actions,
+               Eigen::Ref<Eigen::ArrayXi> actions_) {
+    setBoards(_env);
+    const int count = m_cells.size();
+    const int ranks = _values.size(1);
+    auto values = _values.accessor<float, 2>();
+    auto ranked = _actions.accessor<int64_t, 2>();
+
+    m_order.resize(count);
+    for (int i = 0; i < count; ++i) {
+      m_order[i] = i;
+    }
+    std::stable_sort(m_order.begin(), m_order.end(), [&](int _a, int _b) {
+      return values[_a][0] > values[_b][0];
+    });
+
+    for (const int unit : m_order) {
+      const int own = m_cells[unit];
+      int action = WorkerActionInt::center;
+      for (int r = 0; r < ranks && std::isfinite(values[unit][r]); ++r) {
+        const int target = targetCell(_env.map, own, ranked[unit][r]);
+        if (target == own || (target >= 0 && isFree(target))) {
+          action = ranked[unit][r];
+          break;
+        }
+      }
+      const int target = targetCell(_env.map, own, action);
+      if (target != own) {
+        m_occupied.reset(own);
+      }
+      m_claimed.set(target);
+      actions_(unit) = action;
+    }
+  }
+
+private:
+  inline bool isFree(const int _cell) const {
+    return m_city.test(_cell) ||
+           !(m_blocked.test(_cell) || m_claimed.test(_cell) ||
+             m_occupied.test(_cell));
+  }
+
+  // -1 off the map
+  static inline int targetCell(const lux::GameMap &_map, const int _cell,
+                               const int64_t _action) {
+    int x = _cell % BoardConfig::size;
+    int y = _cell / BoardConfig::size;
+    switch (_action) {
+    case WorkerActionInt::north: --y; break;
+    case WorkerActionInt::east: ++x; break;
+    case WorkerActionInt::south: ++y; break;
+    case WorkerActionInt::west: --x; break;
+    default: return _cell;
+    }
+    if (x < 0 || y < 0 || x >= _map.width || y >= _map.height) {
+      return -1;
+    }
+    return y * BoardConfig::size + x;
+  }
+
+  void setBoards(const kit::Agent &_env) {
+    m_city.reset();
+    m_blocked.reset();
+    m_claimed.reset();
+    m_occupied.reset();
+    m_cells.clear();
+    const auto &player = _env.players[_env.id];
+    const auto &opponent = _env.players[(_env.id + 1) % 2];
+    for (const auto &kv : player.cities) {
+      for (const auto &ctile : kv.second.citytiles) {
+        m_city.set(ctile.pos.y * BoardConfig::size + ctile.pos.x);
+      }
+    }
+    for (const auto &kv : opponent.cities) {
+      for (const auto &ctile : kv.second.citytiles) {
+        m_blocked.set(ctile.pos.y * BoardConfig::size + ctile.pos.x);
+      }
+    }
+    for (const auto &unit : opponent.units) {
+      m_blocked.set(unit.pos.y * BoardConfig::size + unit.pos.x);
+    }
+    // carts are not model driven and stay put
+    for (const auto &unit : player.units) {
+      const int cell = unit.pos.y * BoardConfig::size + unit.pos.x;
+      if (unit.isWorker()) {
+        m_cells.push_back(cell);
+        m_occupied.set(cell);
+      } else {
+        m_blocked.set(cell);
+      }
+    }
+  }
+
+  std::bitset<cells> m_city;
+  std::bitset<cells> m_blocked;
+  std::bitset<cells> m_claimed;
+  std::bitset<cells> m_occupied;
+  std::vector<int> m_cells;
+  std::vector<int> m_order;
+};
+
+#endif /* CONFLICT_RESOLVER_HPP_ */
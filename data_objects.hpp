@@ -41,12 +41,21 @@ struct BatchStateFeature {
                                 torch::dtype(torch::kFloat32)
                                     .requires_grad(false)
                                     .device(DeviceType))),
+        m_positions(torch::zeros({_batch_size}, torch::dtype(torch::kInt64)
+                                                    .requires_grad(false)
+                                                    .device(DeviceType))),
+        m_legal(torch::full({_batch_size}, all_actions_legal<ModelConfig>,
+                            torch::dtype(torch::kInt64)
+                                .requires_grad(false)
+                                .device(DeviceType))),
         m_reward_ftrs(_batch_size) {}
 
   BatchStateFeature(const BatchStateFeature &_other)
       : m_batch_size(_other.m_batch_size),
         m_geometric(_other.m_geometric.detach().clone()),
         m_temporal(_other.m_temporal.detach().clone()),
+        m_positions(_other.m_positions.detach().clone()),
+        m_legal(_other.m_legal.detach().clone()),
         m_reward_ftrs(_other.m_reward_ftrs) {}
 
   BatchStateFeature &operator=(const BatchStateFeature &_other) {
@@ -55,6 +64,8 @@ struct BatchStateFeature {
     m_batch_size = _other.m_batch_size;
     m_geometric = _other.m_geometric.detach().clone();
     m_temporal = _other.m_temporal.detach().clone();
+    m_positions = _other.m_positions.detach().clone();
+    m_legal = _other.m_legal.detach().clone();
     m_reward_ftrs = _other.m_reward_ftrs;
     return *this;
   }
@@ -63,17 +74,29 @@ struct BatchStateFeature {
       : m_batch_size(other_.m_batch_size),
         m_geometric(std::move(other_.m_geometric)),
         m_temporal(std::move(other_.m_temporal)),
+        m_positions(std::move(other_.m_positions)),
+        m_legal(std::move(other_.m_legal)),
         m_reward_ftrs(std::move(other_.m_reward_ftrs)) {}
 
   unsigned m_batch_size;
   torch::Tensor m_geometric;
   torch::Tensor m_temporal;
+  // board cell (y * size + x) of the unit each row belongs to, read by
+  // board wide models and left at 0 by egocentric features
+  torch::Tensor m_positions;
+  // legal action bitmask of each row's unit (bit a set when action a is
+  // legal), all outputs legal unless the feature builder restricts them
+  torch::Tensor m_legal;
   BatchRewardFeature<DeviceType, size, ModelConfig> m_reward_ftrs;
 };
 
 template <torch::DeviceType DeviceType, std::size_t size,
           typename ModelConfig>
 struct SingleStateFeature {
+  static constexpr std::size_t geometric_size =
+      ModelConfig::channels * size * size;
+  static constexpr std::size_t temporal_size = ModelConfig::ts_ftr_count;
+
   SingleStateFeature()
       : m_geometric(torch::zeros(
             {ModelConfig::channels, size, size},
@@ -83,10 +106,13 @@ struct SingleStateFeature {
         m_temporal(torch::zeros({ModelConfig::ts_ftr_count},
                                 torch::dtype(torch::kFloat32)
                                     .requires_grad(false)
-                                    .device(DeviceType))) {}
+                                    .device(DeviceType))),
+        m_position(0), m_legal(all_actions_legal<ModelConfig>) {}
 
   torch::Tensor m_geometric;
   torch::Tensor m_temporal;
+  int64_t m_position;
+  int64_t m_legal;
 };
 
 template <torch::DeviceType DeviceType, std::size_t size,
@@ -107,6 +133,95 @@ struct Transition {
   bool m_is_non_terminal;
 };
 
+// first _count transitions as stacked cpu tensors, for checkpoints
+template <typename ExampleType>
+static void save_transitions(torch::serialize::OutputArchive &archive_,
+                             const std::vector<ExampleType> &_buffer,
+                             const std::size_t _count) {
+  std::vector<torch::Tensor> state_geometric, state_temporal;
+  std::vector<torch::Tensor> next_state_geometric, next_state_temporal;
+  std::vector<int64_t> state_position, next_state_position, action;
+  std::vector<int64_t> state_legal, next_state_legal;
+  std::vector<float> reward;
+  std::vector<uint8_t> is_non_terminal;
+  for (std::size_t i = 0; i < _count; ++i) {
+    const auto &example = _buffer[i];
+    state_geometric.push_back(example.m_state.m_geometric);
+    state_temporal.push_back(example.m_state.m_temporal);
+    state_position.push_back(example.m_state.m_position);
+    state_legal.push_back(example.m_state.m_legal);
+    action.push_back(example.m_action);
+    reward.push_back(example.m_reward);
+    next_state_geometric.push_back(example.m_next_state.m_geometric);
+    next_state_temporal.push_back(example.m_next_state.m_temporal);
+    next_state_position.push_back(example.m_next_state.m_position);
+    next_state_legal.push_back(example.m_next_state.m_legal);
+    is_non_terminal.push_back(example.m_is_non_terminal);
+  }
+  archive_.write("count", torch::tensor(static_cast<int64_t>(_count)));
+  if (_count == 0) {
+    return;
+  }
+  archive_.write("state_geometric", torch::stack(state_geometric).cpu());
+  archive_.write("state_temporal", torch::stack(state_temporal).cpu());
+  archive_.write("state_position", torch::tensor(state_position));
+  archive_.write("state_legal", torch::tensor(state_legal));
+  archive_.write("action", torch::tensor(action));
+  archive_.write("reward", torch::tensor(reward));
+  archive_.write("next_state_geometric",
+                 torch::stack(next_state_geometric).cpu());
+  archive_.write("next_state_temporal", torch::stack(next_state_temporal).cpu());
+  archive_.write("next_state_position", torch::tensor(next_state_position));
+  archive_.write("next_state_legal", torch::tensor(next_state_legal));
+  archive_.write("is_non_terminal",
+                 torch::tensor(is_non_terminal).to(torch::kBool));
+}
+
+// returns the number of transitions restored into the front of buffer_
+template <typename ExampleType>
+static std::size_t load_transitions(torch::serialize::InputArchive &archive_,
+                                    std::vector<ExampleType> &buffer_) {
+  torch::Tensor count;
+  archive_.read("count", count);
+  const std::size_t restored =
+      std::min<std::size_t>(count.item<int64_t>(), buffer_.size());
+  if (restored == 0) {
+    return 0;
+  }
+  torch::Tensor state_geometric, state_temporal, state_position, action,
+      reward, next_state_geometric, next_state_temporal, next_state_position,
+      is_non_terminal, state_legal, next_state_legal;
+  archive_.read("state_geometric", state_geometric);
+  archive_.read("state_temporal", state_temporal);
+  archive_.read("state_position", state_position);
+  archive_.read("action", action);
+  archive_.read("reward", reward);
+  archive_.read("next_state_geometric", next_state_geometric);
+  archive_.read("next_state_temporal", next_state_temporal);
+  archive_.read("next_state_position", next_state_position);
+  archive_.read("is_non_terminal", is_non_terminal);
+  // checkpoints from before legality masks keep every action legal
+  const bool has_legal = archive_.try_read("state_legal", state_legal) &&
+                         archive_.try_read("next_state_legal", next_state_legal);
+  for (std::size_t i = 0; i < restored; ++i) {
+    auto &example = buffer_[i];
+    example.m_state.m_geometric.copy_(state_geometric[i]);
+    example.m_state.m_temporal.copy_(state_temporal[i]);
+    example.m_state.m_position = state_position[i].item<int64_t>();
+    if (has_legal) {
+      example.m_state.m_legal = state_legal[i].item<int64_t>();
+      example.m_next_state.m_legal = next_state_legal[i].item<int64_t>();
+    }
+    example.m_action = action[i].item<int64_t>();
+    example.m_reward = reward[i].item<float>();
+    example.m_next_state.m_geometric.copy_(next_state_geometric[i]);
+    example.m_next_state.m_temporal.copy_(next_state_temporal[i]);
+    example.m_next_state.m_position = next_state_position[i].item<int64_t>();
+    example.m_is_non_terminal = is_non_terminal[i].item<bool>();
+  }
+  return restored;
+}
+
 template <torch::DeviceType DeviceType, std::size_t size,
           typename ModelConfig>
 struct DynamicBatch {
@@ -131,8 +246,12 @@ struct DynamicBatch {
   inline void zero_() {
     m_state.m_geometric.zero_();
     m_state.m_temporal.zero_();
+    m_state.m_positions.zero_();
+    m_state.m_legal.fill_(all_actions_legal<ModelConfig>);
     m_next_state.m_geometric.zero_();
     m_next_state.m_temporal.zero_();
+    m_next_state.m_positions.zero_();
+    m_next_state.m_legal.fill_(all_actions_legal<ModelConfig>);
     m_action.zero_();
     m_reward.zero_();
   }
@@ -143,6 +262,8 @@ struct DynamicBatch {
     m_state.m_geometric.index_put_({_index}, _example.m_state.m_geometric);
     // ts[_index]
     m_state.m_temporal.index_put_({_index}, _example.m_state.m_temporal);
+    m_state.m_positions.index_put_({_index}, _example.m_state.m_position);
+    m_state.m_legal.index_put_({_index}, _example.m_state.m_legal);
 
     // action
     m_action.index_put_({_index}, _example.m_action);
@@ -155,11 +276,38 @@ struct DynamicBatch {
                                         _example.m_next_state.m_geometric);
     m_next_state.m_temporal.index_put_({_index},
                                        _example.m_next_state.m_temporal);
+    m_next_state.m_positions.index_put_({_index},
+                                        _example.m_next_state.m_position);
+    m_next_state.m_legal.index_put_({_index}, _example.m_next_state.m_legal);
 
     // is terminal
     m_is_non_terminal.index_put_({_index}, _example.m_is_non_terminal);
   }
 
+  void get(const int _index,
+           Transition<DeviceType, size, ModelConfig> &example_) const {
+    example_.m_state.m_geometric.index_put_({torch::indexing::None},
+                                            m_state.m_geometric.index({_index}));
+    example_.m_state.m_temporal.index_put_({torch::indexing::None},
+                                           m_state.m_temporal.index({_index}));
+    example_.m_state.m_position =
+        m_state.m_positions.index({_index}).item().template to<int64_t>();
+    example_.m_state.m_legal =
+        m_state.m_legal.index({_index}).item().template to<int64_t>();
+    example_.m_action = m_action.index({_index}).item().template to<int>();
+    example_.m_reward = m_reward.index({_index}).item().template to<float>();
+    example_.m_is_non_terminal =
+        m_is_non_terminal.index({_index}).item().template to<bool>();
+    example_.m_next_state.m_geometric.index_put_(
+        {torch::indexing::None}, m_next_state.m_geometric.index({_index}));
+    example_.m_next_state.m_temporal.index_put_(
+        {torch::indexing::None}, m_next_state.m_temporal.index({_index}));
+    example_.m_next_state.m_position =
+        m_next_state.m_positions.index({_index}).item().template to<int64_t>();
+    example_.m_next_state.m_legal =
+        m_next_state.m_legal.index({_index}).item().template to<int64_t>();
+  }
+
   unsigned m_batch_size;
   BatchStateFeature<DeviceType, size, ModelConfig> m_state;
   torch::Tensor m_action;
@@ -1,6 +1,9 @@
 #ifndef DQN_HPP
 #define DQN_HPP
+#include <ATen/CPUGeneratorImpl.h>
 #include <torch/torch.h>
+#include <type_traits>
+#include <vector>
 
 struct LocallyConnected2DImpl : torch::nn::Module {
   LocallyConnected2DImpl(const int64_t _in_channels,
@@ -18,7 +21,37 @@ struct LocallyConnected2DImpl : torch::nn::Module {
         "m_b", torch::randn({1, _out_channels, _output_size0, _output_size1}));
   }
 
+  // one [B, in*k^2] x [in*k^2, out] matmul per output position. m_W keeps
+  // its original layout so existing checkpoints still load.
   torch::Tensor forward(torch::Tensor x) {
+    const auto batches = x.size(0);
+    const auto positions = m_output_size0 * m_output_size1;
+    const auto patch = m_in_channels * m_kernel * m_kernel;
+    // [B, in, H, W, k^2] -> [H*W, B, in*k^2]
+    x = x.unfold(2, m_kernel, m_stride)
+            .unfold(3, m_kernel, m_stride)
+            .reshape({batches, m_in_channels, m_output_size0, m_output_size1,
+                      m_kernel * m_kernel})
+            .permute({2, 3, 0, 1, 4})
+            .reshape({positions, batches, patch});
+    // [1, out, in, H, W, k^2] -> [H*W, in*k^2, out]
+    auto weight =
+        m_W.squeeze(0).permute({2, 3, 1, 4, 0}).reshape(
+            {positions, patch, m_out_channels});
+    // [H*W, B, out] -> [B, out, H, W]
+    auto out = torch::bmm(x, weight)
+                   .view({m_output_size0, m_output_size1, batches,
+                          m_out_channels})
+                   .permute({2, 3, 0, 1});
+    if (m_channels_last) {
+      // same single copy, written in the layout the next conv wants
+      return out.contiguous(at::MemoryFormat::ChannelsLast).add_(m_b);
+    }
+    return out.contiguous() + m_b;
+  }
+
+  // original broadcast formulation, materializes [B, out, in, H, W, k^2]
+  torch::Tensor forwardBroadcast(torch::Tensor x) {
     auto batches = x.size(0);
     x = x.unfold(2, m_kernel, m_stride).unfold(3, m_kernel, m_stride);
     x = x.contiguous().view(
@@ -34,12 +67,12 @@ struct LocallyConnected2DImpl : torch::nn::Module {
   int64_t m_output_size1;
   int64_t m_kernel;
   int64_t m_stride;
+  bool m_channels_last = false;
   torch::Tensor m_W;
   torch::Tensor m_b;
 };
 TORCH_MODULE(LocallyConnected2D);
 
-// TODO: coop with RandomEngine
 struct NoisyLinearImpl : torch::nn::Module {
   NoisyLinearImpl(const int64_t _in_features, const int64_t _out_features,
                   const float _std_init)
@@ -94,11 +127,15 @@ struct NoisyLinearImpl : torch::nn::Module {
   }
 
   inline void resetNoise() {
-    auto epsilon_in = scaleNoise(m_in_features);
-    auto epsilon_out = scaleNoise(m_out_features);
+    resetNoise(scaleNoise(m_in_features), scaleNoise(m_out_features));
+  }
 
-    m_weight_epsilon.copy_(epsilon_out.ger(epsilon_in));
-    m_bias_epsilon.copy_(epsilon_out);
+  // from already scaled noise, written in place into the epsilon buffers
+  inline void resetNoise(const torch::Tensor &_epsilon_in,
+                         const torch::Tensor &_epsilon_out) {
+    torch::NoGradGuard no_grad;
+    torch::ger_out(m_weight_epsilon, _epsilon_out, _epsilon_in);
+    m_bias_epsilon.copy_(_epsilon_out);
   }
 
   static torch::Tensor scaleNoise(int size) {
@@ -119,13 +156,61 @@ struct NoisyLinearImpl : torch::nn::Module {
 };
 TORCH_MODULE(NoisyLinear);
 
+// Factorized gaussian noise for all of a model's NoisyLinear layers from one
+// draw: a single normal_ over a preallocated buffer on a dedicated generator,
+// the sign(x) sqrt(|x|) scaling in place, then an outer product per layer
+// straight into its epsilon buffers. Keeps the global torch generator out of
+// the noise stream so a seed reproduces it.
+class FactorizedNoise {
+public:
+  FactorizedNoise(std::vector<NoisyLinear> _layers,
+                  const uint64_t _seed = c10::default_rng_seed_val)
+      : m_layers(std::move(_layers)),
+        m_generator(at::make_generator<at::CPUGeneratorImpl>(_seed)) {
+    int64_t size = 0;
+    for (const auto &layer : m_layers) {
+      size += layer->m_in_features + layer->m_out_features;
+    }
+    m_noise = torch::empty({size}, torch::dtype(torch::kFloat32)
+                                       .requires_grad(false)
+                                       .device(torch::kCPU));
+  }
+
+  inline void seed(const uint64_t _seed) { m_generator.set_current_seed(_seed); }
+
+  inline at::Generator &getGenerator() { return m_generator; }
+
+  void reset() {
+    torch::NoGradGuard no_grad;
+    m_noise.normal_(0, 1, m_generator);
+    const auto sign = m_noise.sign();
+    m_noise.abs_().sqrt_().mul_(sign);
+    // one transfer when the layers live off cpu
+    const auto noise =
+        m_noise.to(m_layers.front()->m_weight_epsilon.device(), false, false);
+    int64_t offset = 0;
+    for (auto &layer : m_layers) {
+      const auto epsilon_in = noise.narrow(0, offset, layer->m_in_features);
+      offset += layer->m_in_features;
+      const auto epsilon_out = noise.narrow(0, offset, layer->m_out_features);
+      offset += layer->m_out_features;
+      layer->resetNoise(epsilon_in, epsilon_out);
+    }
+  }
+
+private:
+  std::vector<NoisyLinear> m_layers;
+  at::Generator m_generator;
+  torch::Tensor m_noise;
+};
+
 static int compute_output_size(int w, int f, int s, int p) {
   return (w - f + 2 * p) / s + 1;
 }
 
 struct LinearOnlyDQN : torch::nn::Module {
   LinearOnlyDQN(const int64_t _in_channels, const int64_t _input_size,
-                const int64_t _output_size, float)
+                const int64_t _output_size, float = 0.f)
       : linear1(register_module(
             "linear1",
             torch::nn::Linear(torch::nn::LinearOptions(
@@ -179,6 +264,9 @@ struct SmallDQN : torch::nn::Module {
         input.view({-1, input.size(1) * input.size(2) * input.size(3)})));
     return linear2(input);
   }
+
+  void resetNoise() {}
+
   unsigned m_local_output_size = 0;
   LocallyConnected2D m_local1;
   torch::nn::Linear linear1, linear2;
@@ -186,7 +274,7 @@ struct SmallDQN : torch::nn::Module {
 
 struct ConvOnlyDQN : torch::nn::Module {
   ConvOnlyDQN(const int64_t _in_channels, const int64_t _input_size,
-              const int64_t _output_size, float)
+              const int64_t _output_size, float = 0.f)
       : m_local_output_size(compute_output_size(_input_size, /*kernel*/ 3,
                                                 /*stride*/ 1, /*pad*/ 1)),
         m_conv1(register_module(
@@ -226,6 +314,9 @@ struct BigDQN : torch::nn::Module {
   static constexpr int local_stride = 1;
   static constexpr int local_pad = 0;
   static constexpr int local_channels = 4;
+  // the convs keep the locally connected output size, so the heads see
+  // trunk_channels planes of it
+  static constexpr int trunk_channels = 32;
 
   BigDQN(const int64_t _in_channels, const int64_t _input_size,
          const int64_t _output_size, const float _std_init,
@@ -253,13 +344,13 @@ struct BigDQN : torch::nn::Module {
         m_conv3(register_module(
             "m_conv3",
             torch::nn::Conv2d(
-                torch::nn::Conv2dOptions(16, 32, 3).stride(1).padding(1).bias(
+                torch::nn::Conv2dOptions(16, trunk_channels, 3).stride(1).padding(1).bias(
                     true)))),
-        m_bn_3(register_module("m_bn_3", torch::nn::BatchNorm2d(32))),
+        m_bn_3(register_module("m_bn_3", torch::nn::BatchNorm2d(trunk_channels))),
         m_conv4(register_module(
             "m_conv4",
             torch::nn::Conv2d(
-                torch::nn::Conv2dOptions(32, 64, 3).stride(1).padding(1).bias(
+                torch::nn::Conv2dOptions(trunk_channels, 64, 3).stride(1).padding(1).bias(
                     true)))),
         m_bn_4(register_module("m_bn_4", torch::nn::BatchNorm2d(64))),
         m_conv5(register_module(
@@ -283,25 +374,32 @@ struct BigDQN : torch::nn::Module {
         m_linear1_v(register_module(
             "m_linear1_v",
             torch::nn::Linear(
-                torch::nn::LinearOptions(3872 /* 61952*/, 512).bias(true)))),
+                torch::nn::LinearOptions(featureSize(), 512).bias(true)))),
         m_linear2_v(register_module(
             "m_linear2_v",
             torch::nn::Linear(
                 torch::nn::LinearOptions(512, m_atom_count).bias(true)))),
 
         m_linear1_a(register_module(
-            "m_linear1_a", NoisyLinear(3872 /*61952*/, 512, _std_init))),
+            "m_linear1_a", NoisyLinear(featureSize(), 512, _std_init))),
         m_linear2_a(register_module(
             "m_linear2_a",
-            NoisyLinear(512, _output_size * m_atom_count, _std_init))) {}
-
-  //          m_linear1_a(register_module("m_linear1_a",
-  //          torch::nn::Linear(torch::nn::LinearOptions(3872 /*61952*/,
-  //          512).bias(true)))), m_linear2_a(register_module("m_linear2_a",
-  //          torch::nn::Linear(torch::nn::LinearOptions(512,
-  //          _output_size*m_atom_count).bias(true)))) {}
+            NoisyLinear(512, _output_size * m_atom_count, _std_init))),
+        m_noise({m_linear1_a, m_linear2_a}) {}
 
   torch::Tensor forward(torch::Tensor geometric) {
+    auto input = features(geometric);
+    auto advantage = torch::elu(m_linear1_a(input));
+    advantage = m_linear2_a(advantage);
+
+    auto value = torch::elu(m_linear1_v(input));
+    value = m_linear2_v(value);
+
+    return dueling(value, advantage);
+  }
+
+  // flattened conv trunk output fed to both heads
+  torch::Tensor features(torch::Tensor geometric) {
     auto input = torch::elu(m_local1(geometric));
     input = torch::elu(m_conv1(input));
     input = torch::elu(m_conv2(input));
@@ -311,13 +409,51 @@ struct BigDQN : torch::nn::Module {
     //        input = torch::relu(m_bn_6(m_conv6(input)));
     //        input = torch::relu(m_bn_7(m_conv7(input)));
 
-    input = input.view({-1, input.size(1) * input.size(2) * input.size(3)});
-    auto advantage = torch::elu(m_linear1_a(input));
-    advantage = m_linear2_a(advantage);
+    if (m_channels_last) {
+      // NHWC flatten, a view of a channels_last trunk
+      return input.permute({0, 2, 3, 1})
+          .reshape({-1, input.size(1) * input.size(2) * input.size(3)});
+    }
+    return input.view({-1, input.size(1) * input.size(2) * input.size(3)});
+  }
 
-    auto value = torch::elu(m_linear1_v(input));
-    value = m_linear2_v(value);
+  // Runs the conv trunk in channels_last (NHWC) so CPU convolutions take
+  // their NHWC kernels: conv weights are converted, the locally connected
+  // layer writes its output in that layout and the flatten into the heads
+  // stays a view. The first head linears get their input columns permuted
+  // to the NHWC flatten, so the network computes the same function. Swaps
+  // tensor storage, rebind any FlatParameters afterwards.
+  void toChannelsLast() {
+    if (m_channels_last) {
+      return;
+    }
+    torch::NoGradGuard no_grad;
+    for (auto *conv : {&m_conv1, &m_conv2, &m_conv3, &m_conv4, &m_conv5,
+                       &m_conv6, &m_conv7}) {
+      (*conv)->weight.set_data(
+          (*conv)->weight.contiguous(at::MemoryFormat::ChannelsLast));
+    }
+    const int64_t channels = m_conv3->options.out_channels();
+    const auto to_nhwc_columns = [this, channels](torch::Tensor &weight_) {
+      weight_.set_data(weight_
+                           .view({weight_.size(0), channels,
+                                  m_local_output_size, m_local_output_size})
+                           .permute({0, 2, 3, 1})
+                           .reshape({weight_.size(0), -1})
+                           .contiguous());
+    };
+    to_nhwc_columns(m_linear1_v->weight);
+    to_nhwc_columns(m_linear1_a->m_weight_mu);
+    to_nhwc_columns(m_linear1_a->m_weight_sigma);
+    to_nhwc_columns(m_linear1_a->m_weight_epsilon);
+    m_local1->m_channels_last = true;
+    m_channels_last = true;
+  }
+
+  inline bool isChannelsLast() const { return m_channels_last; }
 
+  inline torch::Tensor dueling(torch::Tensor value,
+                               torch::Tensor advantage) const {
     value = value.view({-1, 1, m_atom_count});
     advantage = advantage.view({-1, m_output_size, m_atom_count});
 
@@ -327,20 +463,184 @@ struct BigDQN : torch::nn::Module {
     return output;
   }
 
-  inline void resetNoise() {
-    m_linear1_a->resetNoise();
-    m_linear2_a->resetNoise();
+  inline void resetNoise() { m_noise.reset(); }
+
+  // width of the flattened trunk, depends on the board size
+  inline int64_t featureSize() const {
+    return int64_t{trunk_channels} * m_local_output_size * m_local_output_size;
   }
 
   unsigned m_local_output_size = 0;
   int64_t m_output_size, m_atom_count;
   float m_v_min, m_v_max;
+  bool m_channels_last = false;
   LocallyConnected2D m_local1;
   torch::nn::Conv2d m_conv1, m_conv2, m_conv3, m_conv4, m_conv5, m_conv6,
       m_conv7;
   torch::nn::BatchNorm2d m_bn_1, m_bn_2, m_bn_3, m_bn_4, m_bn_5, m_bn_6, m_bn_7;
   torch::nn::Linear m_linear1_v, m_linear2_v; //,m_linear1_a,m_linear2_a;
   NoisyLinear m_linear1_a, m_linear2_a;
+  FactorizedNoise m_noise;
+};
+
+// Convolutional trunk over the global, not egocentric, board planes. Runs
+// once per board and hands back the features of each unit's own cell plus a
+// board wide context, so anything reading it stays flat in the unit count.
+struct BoardTrunkImpl : torch::nn::Module {
+  BoardTrunkImpl(const int64_t _in_channels, const int64_t _channels)
+      : m_conv1(register_module(
+            "m_conv1",
+            torch::nn::Conv2d(
+                torch::nn::Conv2dOptions(_in_channels, _channels, 3)
+                    .padding(1)))),
+        m_conv2(register_module(
+            "m_conv2",
+            torch::nn::Conv2d(
+                torch::nn::Conv2dOptions(_channels, _channels, 3).padding(1)))),
+        m_conv3(register_module(
+            "m_conv3",
+            torch::nn::Conv2d(torch::nn::Conv2dOptions(_channels, _channels, 3)
+                                  .padding(2)
+                                  .dilation(2)))),
+        m_conv4(register_module(
+            "m_conv4",
+            torch::nn::Conv2d(torch::nn::Conv2dOptions(_channels, _channels, 3)
+                                  .padding(4)
+                                  .dilation(4)))),
+        m_context(register_module("m_context",
+                                  torch::nn::Linear(_channels, _channels))) {}
+
+  // geometric [B, C, S, S], positions [N] flat cells (y * S + x), boards [N]
+  // the geometric row each position reads -> [N, channels]
+  torch::Tensor forward(torch::Tensor geometric, torch::Tensor positions,
+                        torch::Tensor boards) {
+    auto trunk = torch::elu(m_conv1(geometric));
+    trunk = torch::elu(m_conv2(trunk));
+    trunk = torch::elu(m_conv3(trunk));
+    trunk = torch::elu(m_conv4(trunk));
+
+    // board wide context, the dilated trunk alone does not see every cell
+    auto context = torch::elu(m_context(trunk.mean({2, 3})));
+    auto cells = trunk.flatten(2).transpose(1, 2);
+    return cells.index({boards, positions}) + context.index({boards});
+  }
+
+  torch::nn::Conv2d m_conv1, m_conv2, m_conv3, m_conv4;
+  torch::nn::Linear m_context;
+};
+TORCH_MODULE(BoardTrunk);
+
+// Distributional dueling head over per unit features, value through plain
+// linears and advantage through NoisyLinear as in BigDQN.
+struct DuelingHeadImpl : torch::nn::Module {
+  DuelingHeadImpl(const int64_t _in_features, const int64_t _hidden_size,
+                  const int64_t _output_size, const float _std_init,
+                  const int64_t _atom_count)
+      : m_output_size(_output_size), m_atom_count(_atom_count),
+        m_linear1_v(register_module(
+            "m_linear1_v", torch::nn::Linear(_in_features, _hidden_size))),
+        m_linear2_v(register_module(
+            "m_linear2_v", torch::nn::Linear(_hidden_size, _atom_count))),
+        m_linear1_a(register_module(
+            "m_linear1_a", NoisyLinear(_in_features, _hidden_size, _std_init))),
+        m_linear2_a(register_module(
+            "m_linear2_a",
+            NoisyLinear(_hidden_size, _output_size * _atom_count, _std_init))) {}
+
+  torch::Tensor forward(torch::Tensor input) {
+    auto advantage = torch::elu(m_linear1_a(input));
+    advantage = m_linear2_a(advantage);
+
+    auto value = torch::elu(m_linear1_v(input));
+    value = m_linear2_v(value);
+
+    value = value.view({-1, 1, m_atom_count});
+    advantage = advantage.view({-1, m_output_size, m_atom_count});
+
+    auto output = value + advantage - advantage.mean(1, /*keepdim*/ true);
+    output = torch::nn::functional::softmax(
+        output, torch::nn::functional::SoftmaxFuncOptions(2));
+    return output;
+  }
+
+  int64_t m_output_size, m_atom_count;
+  torch::nn::Linear m_linear1_v, m_linear2_v;
+  NoisyLinear m_linear1_a, m_linear2_a;
 };
+TORCH_MODULE(DuelingHead);
+
+// Fully convolutional alternative to BigDQN: a BoardTrunk read at each
+// unit's cell feeds one dueling head, so acting cost stays flat in the unit
+// count. geometric is either one board shared by every position or one board
+// per position.
+struct BoardDQN : torch::nn::Module {
+  static constexpr int trunk_channels = 32;
+  static constexpr int hidden_size = 128;
+
+  BoardDQN(const int64_t _in_channels, const int64_t _input_size,
+           const int64_t _output_size, const float _std_init,
+           const int64_t _atom_count, const float _v_min, const float _v_max)
+      : m_output_size(_output_size), m_atom_count(_atom_count),
+        m_v_min(_v_min), m_v_max(_v_max),
+        m_trunk(register_module("m_trunk",
+                                BoardTrunk(_in_channels, trunk_channels))),
+        m_head(register_module("m_head",
+                               DuelingHead(trunk_channels, hidden_size,
+                                           _output_size, _std_init,
+                                           _atom_count))),
+        m_noise({m_head->m_linear1_a, m_head->m_linear2_a}) {}
+
+  // geometric [1 or N, C, S, S], positions [N] flat cells (y * S + x)
+  torch::Tensor forward(torch::Tensor geometric, torch::Tensor positions) {
+    return forward(geometric, positions,
+                   geometric.size(0) == 1
+                       ? torch::zeros_like(positions)
+                       : torch::arange(positions.size(0), positions.options()));
+  }
+
+  // boards [N] is the geometric row each position reads, so one pass can
+  // serve units of several boards
+  torch::Tensor forward(torch::Tensor geometric, torch::Tensor positions,
+                        torch::Tensor boards) {
+    return m_head(m_trunk(geometric, positions, boards));
+  }
+
+  inline void resetNoise() { m_noise.reset(); }
+
+  int64_t m_output_size, m_atom_count;
+  float m_v_min, m_v_max;
+  BoardTrunk m_trunk;
+  DuelingHead m_head;
+  FactorizedNoise m_noise;
+};
+
+template <typename Model> struct is_board_model : std::false_type {};
+template <> struct is_board_model<BoardDQN> : std::true_type {};
+
+// models whose NoisyLinear layers draw from a FactorizedNoise m_noise
+template <typename Model> struct has_factorized_noise : std::false_type {};
+template <> struct has_factorized_noise<BigDQN> : std::true_type {};
+template <> struct has_factorized_noise<BoardDQN> : std::true_type {};
+
+// models with a toChannelsLast CPU layout switch
+template <typename Model> struct has_channels_last : std::false_type {};
+template <> struct has_channels_last<BigDQN> : std::true_type {};
+
+// models whose parameters do not depend on the board size, so one set of
+// weights serves every map size
+template <typename Model> struct is_size_invariant_model : std::false_type {};
+template <> struct is_size_invariant_model<BoardDQN> : std::true_type {};
+
+// forward on a batch of state features, board wide models also read the
+// unit positions
+template <typename Model, typename StateFeatures>
+static inline torch::Tensor forward_state(Model &model_,
+                                          const StateFeatures &_state) {
+  if constexpr (is_board_model<Model>::value) {
+    return model_.forward(_state.m_geometric, _state.m_positions);
+  } else {
+    return model_.forward(_state.m_geometric);
+  }
+}
 
 #endif /* DQN_HPP */
@@ -1,6 +1,7 @@
 #ifndef FEATURE_BUILDER_HPP
 #define FEATURE_BUILDER_HPP
 
+#include "actions.hpp"
 #include "board_config.hpp"
 #include "math_util.hpp"
 #include "model_config.hpp"
@@ -91,6 +92,34 @@ template <class Derived> struct FeatureBuilder {
   static void setStateFeatures(const kit::Agent &_env, StateFeatureType &ftrs_) {
     Derived::template setStateFeaturesImpl<BoardConfig, StateFeatureType>(_env, ftrs_);
   }
+
+  // legal action bitmask per worker row: units on cooldown may only stay,
+  // moves off the board are dropped and build needs canBuild
+  template <typename BoardConfig>
+  static void setWorkerLegalActions(const lux::GameMap &_game_map,
+                                    const std::vector<lux::Unit const *> &_workers,
+                                    torch::Tensor &legal_) {
+    constexpr int64_t center = 1 << WorkerActionInt::center;
+    constexpr int64_t moves = (1 << WorkerActionInt::north) |
+                              (1 << WorkerActionInt::east) |
+                              (1 << WorkerActionInt::south) |
+                              (1 << WorkerActionInt::west);
+    auto legal = legal_.template accessor<int64_t, 1>();
+    for (int i = 0; i < _workers.size(); ++i) {
+      const auto &unit = *_workers[i];
+      if (!unit.canAct()) {
+        legal[i] = center;
+        continue;
+      }
+      int64_t bits = center | moves;
+      if (unit.pos.y == 0) bits &= ~(1 << WorkerActionInt::north);
+      if (unit.pos.x == BoardConfig::size - 1) bits &= ~(1 << WorkerActionInt::east);
+      if (unit.pos.y == BoardConfig::size - 1) bits &= ~(1 << WorkerActionInt::south);
+      if (unit.pos.x == 0) bits &= ~(1 << WorkerActionInt::west);
+      if (unit.canBuild(_game_map)) bits |= 1 << WorkerActionInt::build;
+      legal[i] = bits;
+    }
+  }
 };
 
 
@@ -114,6 +143,7 @@ struct WorkerFeatureBuilder : public FeatureBuilder<WorkerFeatureBuilder> {
 
 		VectorizedUnits units(player, BoardConfig::size*BoardConfig::size);
 		emplace_resources<BoardConfig::size>(units.m_workers, game_map, ftrs_.m_geometric);
+		setWorkerLegalActions<BoardConfig>(game_map, units.m_workers, ftrs_.m_legal);
 
 		const int worker_count = units.m_workers.size();
 		const int ctile_count = units.m_city_tiles.size();
@@ -191,6 +221,86 @@ struct WorkerFeatureBuilder : public FeatureBuilder<WorkerFeatureBuilder> {
   }
 };
 
+// Global board planes for board wide models (BoardDQN), same channels as
+// WorkerFeatureBuilder but in map coordinates instead of centered on each
+// worker. The board is built once in row 0 and copied to every worker row so
+// the replay keeps one row per unit, m_positions marks each worker's cell.
+struct BoardFeatureBuilder : public FeatureBuilder<BoardFeatureBuilder> {
+
+  template <typename BoardConfig, typename StateFeatures>
+  static void setStateFeaturesImpl(const kit::Agent &_env, StateFeatures &ftrs_) {
+    torch::NoGradGuard no_grad;
+    ftrs_.m_geometric.zero_();
+    ftrs_.m_temporal.zero_();
+    ftrs_.m_positions.zero_();
+    const float remaining =
+        static_cast<float>(BoardConfig::episode_steps - _env.turn) /
+        static_cast<float>(BoardConfig::episode_steps);
+
+    ftrs_.m_temporal.index_put_({torch::indexing::Slice(0,
+      torch::indexing::None, 1), 0}, remaining);
+
+		const lux::GameMap &game_map = _env.map;
+		const lux::Player &player = _env.players[_env.id];
+
+		VectorizedUnits units(player, BoardConfig::size*BoardConfig::size);
+		const int worker_count = units.m_workers.size();
+		setWorkerLegalActions<BoardConfig>(game_map, units.m_workers, ftrs_.m_legal);
+		if (worker_count == 0) {
+			return;
+		}
+
+		torch::Tensor board = ftrs_.m_geometric.index({0});
+		auto accessor = board.accessor<float, 3>();
+		for (int y = 0; y < game_map.height; y++) {
+			for (int x = 0; x < game_map.width; x++) {
+				const lux::Cell *cell = game_map.getCell(x, y);
+				if (cell->hasResource()) {
+					switch (cell->resource.type) {
+					case lux::ResourceType::wood:
+						accessor[WorkerModelConfig::WOOD][y][x] = cell->resource.amount;
+						break;
+					case lux::ResourceType::coal:
+						accessor[WorkerModelConfig::COAL][y][x] = cell->resource.amount;
+						break;
+					case lux::ResourceType::uranium:
+						accessor[WorkerModelConfig::URANIUM][y][x] = cell->resource.amount;
+						break;
+					}
+				}
+			}
+		}
+
+		auto positions = ftrs_.m_positions.template accessor<int64_t, 1>();
+		for (int i = 0; i < worker_count; ++i) {
+			const auto &pos = units.m_workers[i]->pos;
+			accessor[WorkerModelConfig::PERCENT_CARGO_REMAINING][pos.y][pos.x] =
+				static_cast<float>(units.m_workers[i]->getCargoSpaceLeft()) /
+				static_cast<float>(BoardConfig::worker_max_cargo);
+			positions[i] = pos.y * BoardConfig::size + pos.x;
+		}
+		for (const auto *ctile : units.m_city_tiles) {
+			accessor[WorkerModelConfig::CITIES][ctile->pos.y][ctile->pos.x] = 1.f;
+		}
+		board.index({WorkerModelConfig::PERCENT_TIME_REMAINING}).fill_(remaining);
+
+		min_max_norm(board.index({WorkerModelConfig::WOOD}), 0.f, true);
+		if (player.researchedCoal()) {
+			min_max_norm(board.index({WorkerModelConfig::COAL}), 0.f, true);
+		} else {
+			board.index({WorkerModelConfig::COAL}).fill_(0.f);
+		}
+		if (player.researchedUranium()) {
+			min_max_norm(board.index({WorkerModelConfig::URANIUM}), 0.f, true);
+		} else {
+			board.index({WorkerModelConfig::URANIUM}).fill_(0.f);
+		}
+
+		ftrs_.m_geometric.index_put_(
+				{torch::indexing::Slice(1, worker_count, 1)}, board);
+	}
+};
+
 struct CityTileFeatureBuilder : public FeatureBuilder<CityTileFeatureBuilder> {
 	template <typename BoardConfig, typename StateFeatures>
   static void setStateFeaturesImpl(const kit::Agent &_env, StateFeatures &ftrs_) {
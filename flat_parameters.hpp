@@ -0,0 +1,82 @@
+#ifndef FLAT_PARAMETERS_HPP_
+#define FLAT_PARAMETERS_HPP_
+
+#include "weight_snapshot.hpp"
+#include <cstdint>
+#include <torch/torch.h>
+#include <vector>
+
+// Moves a model's float parameters and buffers into one contiguous buffer
+// and rebinds each tensor as a view into it, in WeightSnapshot order. The
+// tensors keep their TensorImpl, so optimizers and anything else holding
+// them stay valid. Two models with the same architecture then share a flat
+// layout and can be synced with a single copy or lerp. Tensors of another
+// dtype (BatchNorm's num_batches_tracked) are left in place and copied one
+// by one. Tensors must be dense (contiguous in some dimension order).
+//
+// Bind after the model has been moved to its device; moving it to another
+// device afterwards gives the tensors fresh storage and needs a new bind.
+class FlatParameters {
+public:
+  FlatParameters() = default;
+
+  template <typename Model> explicit FlatParameters(Model &model_) {
+    bind(model_);
+  }
+
+  template <typename Model> void bind(Model &model_) {
+    torch::NoGradGuard no_grad;
+    m_rest.clear();
+    auto tensors = WeightSnapshot::modelTensors(model_);
+    int64_t numel = 0;
+    for (const auto &tensor : tensors) {
+      if (tensor.scalar_type() == torch::kFloat32) {
+        numel += tensor.numel();
+      }
+    }
+    m_flat = torch::empty({numel}, tensors.front().options()
+                                       .dtype(torch::kFloat32)
+                                       .requires_grad(false));
+    int64_t offset = 0;
+    for (auto &tensor : tensors) {
+      if (tensor.scalar_type() != torch::kFloat32) {
+        m_rest.push_back(tensor);
+        continue;
+      }
+      // keep each tensor's strides, e.g. channels_last conv weights
+      const auto sizes = tensor.sizes().vec();
+      const auto strides = tensor.strides().vec();
+      m_flat.as_strided(sizes, strides, offset).copy_(tensor);
+      tensor.set_(m_flat.storage(), offset, sizes, strides);
+      offset += tensor.numel();
+    }
+  }
+
+  inline const torch::Tensor &getFlat() const { return m_flat; }
+
+  // this = other
+  void copyFrom(const FlatParameters &_other) {
+    torch::NoGradGuard no_grad;
+    m_flat.copy_(_other.m_flat);
+    copyRest(_other);
+  }
+
+  // this += tau * (other - this)
+  void lerpFrom(const FlatParameters &_other, const float _tau) {
+    torch::NoGradGuard no_grad;
+    m_flat.lerp_(_other.m_flat, _tau);
+    copyRest(_other);
+  }
+
+private:
+  void copyRest(const FlatParameters &_other) {
+    for (std::size_t i = 0; i < m_rest.size(); ++i) {
+      m_rest[i].copy_(_other.m_rest[i]);
+    }
+  }
+
+  torch::Tensor m_flat;
+  std::vector<torch::Tensor> m_rest;
+};
+
+#endif /* FLAT_PARAMETERS_HPP_ */
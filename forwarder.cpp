@@ -2,6 +2,7 @@
 #include "lux/define.cpp"
 #include "lux/client.hpp"
 #include "server.hpp"
+#include <cstdlib>
 #include <sstream>
 #include <unistd.h>
 #include <string.h>
@@ -21,9 +22,11 @@ static inline void initialize_game(char * membuf_) {
 	while (*membuf_ != ack_input_received) {}
 }
 
-int main()
+// argv[1]: actor slot to forward to, 0 when omitted
+int main(int argc, char **argv)
 {
-	char * membuf = locate_memory_map();
+	const std::size_t slot = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 0;
+	char * membuf = locate_memory_map(actor_slot_key(slot));
 	initialize_game(membuf);
 
 	while (true) {
@@ -0,0 +1,120 @@
+#ifndef FROZEN_MODULE_HPP_
+#define FROZEN_MODULE_HPP_
+
+#include "dqn.hpp"
+#include <algorithm>
+#include <string>
+#include <torch/csrc/jit/api/module.h>
+#include <torch/csrc/jit/frontend/tracer.h>
+#include <torch/script.h>
+#include <torch/torch.h>
+#include <vector>
+
+// Traces an eager model's eval forward into a TorchScript module and freezes
+// it. Parameters become constants, NoisyLinear reduces to its mu weights
+// (the eval forward never reads sigma or epsilon) and freeze runs the frozen
+// graph optimizations over the result. The frozen module is a deep copy, so
+// later optimizer steps on the eager model do not leak into it.
+template <typename Model>
+static torch::jit::Module
+freeze_for_inference(Model &model_,
+                     const std::vector<torch::jit::IValue> &_example_inputs,
+                     const std::string &_name) {
+  torch::NoGradGuard no_grad;
+  const bool was_training = model_.is_training();
+  model_.eval();
+
+  // register the eager tensors themselves so the tracer records attribute
+  // reads on self rather than anonymous constants
+  torch::jit::Module module("__torch__." + _name);
+  module.register_attribute("training", c10::BoolType::get(), false);
+  const auto attribute_name = [](std::string _key) {
+    std::replace(_key.begin(), _key.end(), '.', '_');
+    return _key;
+  };
+  for (const auto &kv : model_.named_parameters(true)) {
+    module.register_parameter(attribute_name(kv.key()), kv.value(), false);
+  }
+  for (const auto &kv : model_.named_buffers(true)) {
+    module.register_buffer(attribute_name(kv.key()), kv.value());
+  }
+
+  auto traced = torch::jit::tracer::trace(
+      torch::jit::Stack(_example_inputs.begin(), _example_inputs.end()),
+      [&model_](torch::jit::Stack _inputs) -> torch::jit::Stack {
+        if constexpr (is_board_model<Model>::value) {
+          return {model_.forward(_inputs[0].toTensor(), _inputs[1].toTensor())};
+        } else {
+          return {model_.forward(_inputs[0].toTensor())};
+        }
+      },
+      [](const torch::autograd::Variable &) { return std::string(); },
+      /*strict*/ true, /*force_outplace*/ false, &module);
+  auto *forward = module._ivalue()->compilation_unit()->create_function(
+      c10::QualifiedName(*module.type()->name(), "forward"),
+      traced.first->graph);
+  module.type()->addMethod(forward);
+
+  model_.train(was_training);
+  return torch::jit::freeze(module.deepcopy());
+}
+
+// Frozen TorchScript stand-in for an eager DQN on the acting path, same
+// forward signature as Model. Checkpoints are plain TorchScript archives, so
+// a FrozenModule can also be loaded from disk without the eager model.
+// Board models are traced against a single shared board.
+template <typename Model, torch::DeviceType DeviceType> class FrozenModule {
+public:
+  FrozenModule(Model &model_, const int64_t _in_channels,
+               const int64_t _input_size)
+      : m_in_channels(_in_channels), m_input_size(_input_size) {
+    refresh(model_);
+  }
+
+  explicit FrozenModule(const std::string &_path)
+      : m_in_channels(0), m_input_size(0),
+        m_module(torch::jit::load(_path, torch::Device(DeviceType))) {}
+
+  // re-export from the eager weights
+  void refresh(Model &model_) {
+    const auto options =
+        torch::dtype(torch::kFloat32).requires_grad(false).device(DeviceType);
+    std::vector<torch::jit::IValue> example_inputs;
+    if constexpr (is_board_model<Model>::value) {
+      example_inputs.push_back(
+          torch::zeros({1, m_in_channels, m_input_size, m_input_size}, options));
+      example_inputs.push_back(
+          torch::zeros({2}, options.dtype(torch::kInt64)));
+    } else {
+      example_inputs.push_back(
+          torch::zeros({2, m_in_channels, m_input_size, m_input_size}, options));
+    }
+    m_module = freeze_for_inference(model_, example_inputs, "FrozenDQN");
+  }
+
+  inline torch::Tensor forward(torch::Tensor geometric) {
+    torch::NoGradGuard no_grad;
+    return m_module.forward({geometric}).toTensor();
+  }
+
+  inline torch::Tensor forward(torch::Tensor geometric,
+                               torch::Tensor positions) {
+    torch::NoGradGuard no_grad;
+    return m_module.forward({geometric, positions}).toTensor();
+  }
+
+  inline void save(const std::string &_path) const { m_module.save(_path); }
+
+  inline const torch::jit::Module &getModule() const { return m_module; }
+
+private:
+  int64_t m_in_channels;
+  int64_t m_input_size;
+  torch::jit::Module m_module;
+};
+
+template <typename Model, torch::DeviceType DeviceType>
+struct is_board_model<FrozenModule<Model, DeviceType>>
+    : is_board_model<Model> {};
+
+#endif /* FROZEN_MODULE_HPP_ */
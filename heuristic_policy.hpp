@@ -0,0 +1,143 @@
+#ifndef HEURISTIC_POLICY_HPP_
+#define HEURISTIC_POLICY_HPP_
+
+#include "actions.hpp"
+#include "conflict_resolver.hpp"
+#include "lux/kit.hpp"
+#include <Eigen/Dense>
+#include <array>
+#include <cstdint>
+#include <torch/torch.h>
+#include <tuple>
+
+// The nearest resource / nearest city rule of simple.cpp without a model:
+// workers with cargo space head for the closest mineable resource, full
+// workers head for the closest own citytile, or build when they have no city
+// to return to. Instead of a scan over every tile per worker, one multi
+// source BFS per target set gives each cell the step towards its nearest
+// target, so a turn is O(cells) whatever the worker count. Moves go through
+// the same ConflictResolver as the model's, in unit order. Cheap enough to
+// stand in for inference when the turn is about to run out of time.
+template <typename BoardConfig> class HeuristicPolicy {
+public:
+  static constexpr int cells = BoardConfig::size * BoardConfig::size;
+
+  using PawnActions = Eigen::Array<int, cells, 1>;
+  using ActionReturn =
+      std::tuple<const Eigen::Ref<const Eigen::ArrayXi>,
+                 const Eigen::Ref<const Eigen::ArrayXi>>;
+
+  HeuristicPolicy()
+      : m_worker_actions(PawnActions::Zero()),
+        m_citytile_actions(PawnActions::Zero()) {}
+
+  // worker actions in unit order, as InferenceAgent::act
+  ActionReturn act(const kit::Agent &_env) {
+    const auto &map = _env.map;
+    const auto &player = _env.players[_env.id];
+
+    int resources = 0, cities = 0;
+    for (int y = 0; y < map.height; ++y) {
+      for (int x = 0; x < map.width; ++x) {
+        const auto *cell = map.getCell(x, y);
+        if (cell->hasResource() && isMineable(player, cell->resource.type)) {
+          m_resource_queue[resources++] = y * BoardConfig::size + x;
+        }
+      }
+    }
+    for (const auto &kv : player.cities) {
+      for (const auto &ctile : kv.second.citytiles) {
+        m_city_queue[cities++] = ctile.pos.y * BoardConfig::size + ctile.pos.x;
+      }
+    }
+    flowField(map, m_resource_queue, resources, m_resource_step);
+    flowField(map, m_city_queue, cities, m_city_step);
+
+    int count = 0;
+    for (const auto &unit : player.units) {
+      if (!unit.isWorker()) {
+        continue;
+      }
+      const int cell = unit.pos.y * BoardConfig::size + unit.pos.x;
+      int action = WorkerActionInt::center;
+      if (!unit.canAct()) {
+        action = WorkerActionInt::center;
+      } else if (unit.getCargoSpaceLeft() > 0 && resources > 0) {
+        action = m_resource_step[cell];
+      } else if (cities > 0) {
+        action = m_city_step[cell];
+      } else if (unit.canBuild(map)) {
+        action = WorkerActionInt::build;
+      }
+      m_actions[count++] = action;
+    }
+
+    m_worker_count = count;
+    m_citytile_actions(0) = 0;
+    if (count > 0) {
+      // one rank per worker, all tied, so the resolver keeps unit order
+      m_resolver.resolve(
+          _env, torch::zeros({count, 1}),
+          torch::from_blob(m_actions.data(), {count, 1}, torch::kInt64),
+          m_worker_actions.head(count));
+    }
+    return ActionReturn(m_worker_actions.head(m_worker_count),
+                        m_citytile_actions.head(1));
+  }
+
+private:
+  static inline bool isMineable(const lux::Player &_player,
+                                const lux::ResourceType _type) {
+    return _type == lux::ResourceType::wood ||
+           (_type == lux::ResourceType::coal && _player.researchedCoal()) ||
+           (_type == lux::ResourceType::uranium && _player.researchedUranium());
+  }
+
+  // step_[cell] is the move one cell closer to the nearest of the _count
+  // seeds in queue_, center on a seed or when no seed is reachable. queue_
+  // is reused as the BFS queue
+  static void flowField(const lux::GameMap &_map,
+                        std::array<int, cells> &queue_, const int _count,
+                        std::array<int, cells> &step_) {
+    // neighbour offset, and the move that brings the neighbour back here
+    constexpr int dx[] = {0, 1, 0, -1};
+    constexpr int dy[] = {-1, 0, 1, 0};
+    constexpr int back[] = {WorkerActionInt::south, WorkerActionInt::west,
+                            WorkerActionInt::north, WorkerActionInt::east};
+    std::array<bool, cells> seen{};
+    step_.fill(WorkerActionInt::center);
+    for (int i = 0; i < _count; ++i) {
+      seen[queue_[i]] = true;
+    }
+    int tail = _count;
+    for (int head = 0; head < tail; ++head) {
+      const int cell = queue_[head];
+      const int x = cell % BoardConfig::size;
+      const int y = cell / BoardConfig::size;
+      for (int d = 0; d < 4; ++d) {
+        const int nx = x + dx[d], ny = y + dy[d];
+        if (nx < 0 || ny < 0 || nx >= _map.width || ny >= _map.height) {
+          continue;
+        }
+        const int next = ny * BoardConfig::size + nx;
+        if (!seen[next]) {
+          seen[next] = true;
+          step_[next] = back[d];
+          queue_[tail++] = next;
+        }
+      }
+    }
+  }
+
+  std::array<int, cells> m_resource_queue;
+  std::array<int, cells> m_city_queue;
+  std::array<int, cells> m_resource_step;
+  std::array<int, cells> m_city_step;
+  std::array<int64_t, cells> m_actions;
+  PawnActions m_worker_actions;
+  PawnActions m_citytile_actions;
+  ConflictResolver<BoardConfig> m_resolver;
+  int m_worker_count = 0;
+};
+
+#endif /* HEURISTIC_POLICY_HPP_ */
@@ -18,6 +18,9 @@ struct HyperParameters {
   static constexpr float m_actor_epsilon_decay = 15000;
   static constexpr float m_actor_epsilon_start = 1;
   static constexpr float m_actor_epsilon_end = .01;
+  // with several actors, actor i ends at eps^(1 + alpha * i / (actors - 1))
+  static constexpr float m_actor_apex_epsilon = .4;
+  static constexpr float m_actor_apex_alpha = 7;
 
   static constexpr float m_nn_lr = .01;
   static constexpr std::size_t m_nn_step_size = 6;
@@ -30,6 +33,11 @@ struct HyperParameters {
   static constexpr std::size_t m_nn_atom_count = 75;
 
   static constexpr std::size_t m_nn_target_model_update = 5000;
+  static constexpr float m_nn_target_tau = 0.; // polyak per step, 0 = hard
+
+  static constexpr float m_learner_replay_ratio = 1.;       // steps per frame
+  static constexpr std::size_t m_learner_publish_interval = 10; // steps
+  static constexpr std::size_t m_learner_max_lag = 0;       // 0 = unbounded
 
   static constexpr float m_reward_mine_beta = 1.;
   static constexpr float m_reward_deposit_beta = 1.;   // 3.;
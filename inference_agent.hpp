@@ -0,0 +1,86 @@
+#ifndef INFERENCE_AGENT_HPP_
+#define INFERENCE_AGENT_HPP_
+
+#include <Eigen/Dense>
+#include <tuple>
+#include <torch/torch.h>
+#include "board_config.hpp"
+#include "conflict_resolver.hpp"
+#include "data_objects.hpp"
+#include "dqn.hpp"
+#include "feature_builder.hpp"
+#include "hyper_parameters.hpp"
+#include "math_util.hpp"
+#include "model_config.hpp"
+#include "pawn_types.hpp"
+
+// Greedy acting without any of the training machinery: one feature buffer,
+// one model forward per turn. Mirrors the greedy branch of Actor, Model is
+// anything with the DQN forward signature (eager, FrozenModule, quantized).
+template <typename Model, typename WorkerFeatures, torch::DeviceType DeviceType,
+					typename BoardConfig>
+class InferenceAgent {
+public:
+	using PawnActions = Eigen::Array<int, BoardConfig::size * BoardConfig::size, 1>;
+	using ActionReturn = std::tuple<
+		const Eigen::Ref<const Eigen::ArrayXi>,
+		const Eigen::Ref<const Eigen::ArrayXi>>;
+
+	template <typename... Args>
+	explicit InferenceAgent(Args &&... args)
+			: m_model(std::forward<Args>(args)...),
+				m_worker_features(BoardConfig::size * BoardConfig::size),
+				m_support(torch::linspace(HyperParameters::m_nn_v_min,
+																	HyperParameters::m_nn_v_max,
+																	HyperParameters::m_nn_atom_count,
+																	torch::dtype(torch::kFloat32)
+																			.requires_grad(false)
+																			.device(DeviceType))),
+				m_worker_actions(PawnActions::Zero()),
+				m_citytile_actions(PawnActions::Zero()),
+				m_worker_count(0), m_citytile_count(0) {}
+
+	ActionReturn act(const kit::Agent &_agent) {
+		torch::NoGradGuard no_grad;
+		m_worker_count = Worker::get_pawn_ids(_agent).size();
+		// citytiles are not model driven yet, same as Actor
+		m_citytile_count = 1;
+		m_citytile_actions.head(m_citytile_count) = 0;
+
+		if (m_worker_count > 0) {
+			WorkerFeatures::template setStateFeatures<BoardConfig>(_agent, m_worker_features);
+			const auto slice = torch::indexing::Slice(0, m_worker_count, 1);
+			torch::Tensor q_distribution;
+			if constexpr (is_board_model<Model>::value) {
+				q_distribution = m_model.forward(
+						m_worker_features.m_geometric.index({torch::indexing::Slice(0, 1, 1)}),
+						m_worker_features.m_positions.index({slice}));
+			} else {
+				q_distribution = m_model.forward(m_worker_features.m_geometric.index({slice}));
+			}
+			const auto legal = expand_action_mask(
+					m_worker_features.m_legal.index({slice}), WorkerModelConfig::output_size);
+			const auto ranked = masked_topk((q_distribution * m_support).sum(2).cpu(),
+					legal.cpu(), static_cast<int64_t>(WorkerActions::Count));
+			m_conflict_resolver.resolve(_agent, std::get<0>(ranked), std::get<1>(ranked),
+					m_worker_actions.head(m_worker_count));
+		}
+
+		return ActionReturn(m_worker_actions.head(m_worker_count),
+												m_citytile_actions.head(m_citytile_count));
+	}
+
+	inline Model &getModel() { return m_model; }
+
+private:
+	Model m_model;
+	BatchStateFeature<DeviceType, BoardConfig::size, WorkerModelConfig> m_worker_features;
+	torch::Tensor m_support;
+	PawnActions m_worker_actions;
+	PawnActions m_citytile_actions;
+	ConflictResolver<BoardConfig> m_conflict_resolver;
+	std::size_t m_worker_count;
+	std::size_t m_citytile_count;
+};
+
+#endif /* INFERENCE_AGENT_HPP_ */
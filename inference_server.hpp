@@ -0,0 +1,329 @@
+#ifndef INFERENCE_SERVER_HPP_
+#define INFERENCE_SERVER_HPP_
+
+#include "dqn.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <torch/torch.h>
+#include <vector>
+
+// Bounded multi producer multi consumer ring (Vyukov). Each cell carries a
+// sequence number, so producers and the consumer only contend on their own
+// cursor. push fails when full, pop when empty.
+template <typename T, std::size_t Capacity> class BoundedQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  BoundedQueue() {
+    for (std::size_t i = 0; i < Capacity; ++i) {
+      m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool push(T &&value_) {
+    std::size_t pos = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = m_cells[pos & (Capacity - 1)];
+      const std::size_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                        static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+          cell.m_value = std::move(value_);
+          cell.m_sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool pop(T &value_) {
+    std::size_t pos = m_head.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = m_cells[pos & (Capacity - 1)];
+      const std::size_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                        static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (m_head.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+          value_ = std::move(cell.m_value);
+          cell.m_sequence.store(pos + Capacity, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  inline bool empty() const {
+    return m_head.load(std::memory_order_relaxed) ==
+           m_tail.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Cell {
+    std::atomic<std::size_t> m_sequence;
+    T m_value;
+  };
+
+  std::array<Cell, Capacity> m_cells;
+  alignas(64) std::atomic<std::size_t> m_tail{0};
+  alignas(64) std::atomic<std::size_t> m_head{0};
+};
+
+// Power of two buckets: bucket 0 counts zeros, bucket b counts values in
+// [2^(b-1), 2^b). Records from any thread.
+class Histogram {
+public:
+  static constexpr std::size_t bucket_count = 32;
+
+  explicit Histogram(const char *_name) : m_name(_name) {}
+
+  inline void record(const uint64_t _value) {
+    const std::size_t bucket =
+        _value == 0 ? 0
+                    : std::min<std::size_t>(64 - __builtin_clzll(_value),
+                                            bucket_count - 1);
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(_value, std::memory_order_relaxed);
+  }
+
+  inline uint64_t getCount() const {
+    return m_count.load(std::memory_order_relaxed);
+  }
+  inline uint64_t getSum() const { return m_sum.load(std::memory_order_relaxed); }
+  inline uint64_t getBucket(const std::size_t _bucket) const {
+    return m_buckets[_bucket].load(std::memory_order_relaxed);
+  }
+
+  void print(std::ostream &out_) const {
+    const uint64_t count = getCount();
+    out_ << m_name << " count: " << count
+         << " mean: " << (count ? static_cast<double>(getSum()) / count : 0.);
+    for (std::size_t b = 0; b < bucket_count; ++b) {
+      const uint64_t n = getBucket(b);
+      if (n > 0) {
+        out_ << " <" << (uint64_t(1) << b) << ": " << n;
+      }
+    }
+    out_ << std::endl;
+  }
+
+private:
+  const char *m_name;
+  std::array<std::atomic<uint64_t>, bucket_count> m_buckets{};
+  std::atomic<uint64_t> m_count{0};
+  std::atomic<uint64_t> m_sum{0};
+};
+
+// Coalesces forwards from concurrent actors into one batch on a dedicated
+// thread. A batch closes once it holds _max_rows units or its oldest request
+// has waited _max_latency, then runs one forward and fulfils each request's
+// future with its own rows. Egocentric models batch on the unit rows, board
+// models stack one board per request and map each unit to its board.
+// _before_batch runs on the server thread ahead of every forward, e.g. to
+// pull newly published weights into the model.
+template <typename Model, std::size_t QueueCapacity = 256>
+class InferenceServer {
+public:
+  using model_type = Model;
+
+  InferenceServer(Model &model_, const int64_t _max_rows,
+                  const std::chrono::microseconds _max_latency,
+                  const std::size_t _stats_interval = 0,
+                  std::function<void()> _before_batch = {})
+      : m_model(model_), m_max_rows(_max_rows), m_max_latency(_max_latency),
+        m_stats_interval(_stats_interval),
+        m_before_batch(std::move(_before_batch)),
+        m_batch_rows("inference batch rows"),
+        m_queue_delay("inference queue delay us"),
+        m_thread(&InferenceServer::run, this) {}
+
+  InferenceServer(const InferenceServer &) = delete;
+  InferenceServer &operator=(const InferenceServer &) = delete;
+
+  ~InferenceServer() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+  }
+
+  // geometric [N, C, S, S] for egocentric models; [1, C, S, S] plus
+  // positions [N] for board models
+  std::future<torch::Tensor> submit(torch::Tensor _geometric,
+                                    torch::Tensor _positions = {}) {
+    auto request = std::make_unique<Request>();
+    request->m_geometric = std::move(_geometric);
+    request->m_positions = std::move(_positions);
+    request->m_enqueued = std::chrono::steady_clock::now();
+    auto result = request->m_result.get_future();
+    while (!m_queue.push(std::move(request))) {
+      std::this_thread::yield();
+    }
+    if (m_idle.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_cv.notify_one();
+    }
+    return result;
+  }
+
+  inline const Histogram &getBatchRows() const { return m_batch_rows; }
+  inline const Histogram &getQueueDelay() const { return m_queue_delay; }
+
+private:
+  struct Request {
+    torch::Tensor m_geometric;
+    torch::Tensor m_positions;
+    std::promise<torch::Tensor> m_result;
+    std::chrono::steady_clock::time_point m_enqueued;
+  };
+
+  static inline int64_t rows(const Request &_request) {
+    return is_board_model<Model>::value ? _request.m_positions.size(0)
+                                        : _request.m_geometric.size(0);
+  }
+
+  void run() {
+    std::vector<std::unique_ptr<Request>> batch;
+    std::unique_ptr<Request> request;
+    std::size_t batches = 0;
+    while (true) {
+      if (!m_queue.pop(request)) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.store(true, std::memory_order_release);
+        m_cv.wait_for(lock, m_max_latency,
+                      [this] { return m_stop || !m_queue.empty(); });
+        m_idle.store(false, std::memory_order_relaxed);
+        if (m_stop && m_queue.empty()) {
+          return;
+        }
+        continue;
+      }
+      const auto deadline = request->m_enqueued + m_max_latency;
+      int64_t batch_rows = rows(*request);
+      batch.push_back(std::move(request));
+      while (batch_rows < m_max_rows &&
+             std::chrono::steady_clock::now() < deadline) {
+        if (m_queue.pop(request)) {
+          batch_rows += rows(*request);
+          batch.push_back(std::move(request));
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      forward(batch, batch_rows);
+      batch.clear();
+      if (m_stats_interval > 0 && ++batches % m_stats_interval == 0) {
+        m_batch_rows.print(std::cout);
+        m_queue_delay.print(std::cout);
+      }
+    }
+  }
+
+  void forward(std::vector<std::unique_ptr<Request>> &batch_,
+               const int64_t _batch_rows) {
+    if (m_before_batch) {
+      m_before_batch();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<torch::Tensor> geometric, positions, boards;
+    std::vector<int64_t> sizes;
+    geometric.reserve(batch_.size());
+    sizes.reserve(batch_.size());
+    for (const auto &request : batch_) {
+      geometric.push_back(request->m_geometric);
+      sizes.push_back(rows(*request));
+      m_queue_delay.record(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              start - request->m_enqueued)
+              .count());
+    }
+    m_batch_rows.record(_batch_rows);
+    try {
+      torch::NoGradGuard no_grad;
+      torch::Tensor output;
+      if constexpr (is_board_model<Model>::value) {
+        for (std::size_t i = 0; i < batch_.size(); ++i) {
+          positions.push_back(batch_[i]->m_positions);
+          boards.push_back(torch::full({sizes[i]}, static_cast<int64_t>(i),
+                                       batch_[i]->m_positions.options()));
+        }
+        output = m_model.forward(torch::cat(geometric), torch::cat(positions),
+                                 torch::cat(boards));
+      } else {
+        output = m_model.forward(torch::cat(geometric));
+      }
+      const auto outputs = output.split_with_sizes(sizes);
+      for (std::size_t i = 0; i < batch_.size(); ++i) {
+        batch_[i]->m_result.set_value(outputs[i]);
+      }
+    } catch (...) {
+      for (auto &request : batch_) {
+        request->m_result.set_exception(std::current_exception());
+      }
+    }
+  }
+
+  Model &m_model;
+  const int64_t m_max_rows;
+  const std::chrono::microseconds m_max_latency;
+  const std::size_t m_stats_interval;
+  std::function<void()> m_before_batch;
+  BoundedQueue<std::unique_ptr<Request>, QueueCapacity> m_queue;
+  Histogram m_batch_rows;
+  Histogram m_queue_delay;
+  std::atomic<bool> m_idle{false};
+  bool m_stop = false;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::thread m_thread;
+};
+
+// Stands in for the model in Actor and InferenceAgent: every forward goes
+// through the server and blocks on its result.
+template <typename Server> class InferenceClient {
+public:
+  explicit InferenceClient(Server &server_) : m_server(server_) {}
+
+  inline torch::Tensor forward(torch::Tensor geometric) {
+    return m_server.submit(std::move(geometric)).get();
+  }
+
+  inline torch::Tensor forward(torch::Tensor geometric,
+                               torch::Tensor positions) {
+    return m_server.submit(std::move(geometric), std::move(positions)).get();
+  }
+
+private:
+  Server &m_server;
+};
+
+template <typename Server>
+struct is_board_model<InferenceClient<Server>>
+    : is_board_model<typename Server::model_type> {};
+
+#endif /* INFERENCE_SERVER_HPP_ */
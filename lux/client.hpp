@@ -8,16 +8,14 @@
 #define SHMSZ     27
 #define KEY 5678
 
-char * locate_memory_map() {
+char * locate_memory_map(const key_t key = KEY) {
     int shmid;
-    key_t key;
     char *shm, *s;
 
     /*
      * We need to get the segment named
-     * "5678", created by the server.
+     * "5678" (or an actor slot's key), created by the server.
      */
-    key = KEY;
 
     /*
      * Locate the segment.
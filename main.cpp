@@ -7,6 +7,8 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <memory>
+#include <type_traits>
 #include "lux/kit.hpp"
 #include "lux/define.cpp"
 #include "hyper_parameters.hpp"
@@ -17,196 +19,116 @@
 #include "dqn.hpp"
 #include "model_learner.hpp"
 #include "trainer.hpp"
+#include "turn_scheduler.hpp"
 #include "random_engine.hpp"
 #include "actions.hpp"
-
-static inline void print_board(const kit::Agent& _env) {
-	std::stringstream ss;
-	const auto& player = _env.players[_env.id];
-	const auto& cities = player.cities;
-		
-	const auto& units = player.units;
-	std::unordered_set<const lux::Cell*> unit_cells;	
-	const auto& map = _env.map;
-
-	for (const auto& unit : units) {
-		unit_cells.insert(map.getCellByPos(unit.pos));
-	}
-	
-	ss << "E: " << _env.turn << " F: " << player.getFuel() << " WC: " << player.getWoodCargo() << " U: " << units.size() << " CT: " << player.cityTileCount << " RP: " << player.researchPoints << std::endl;
-	for (int y = 0; y < BoardConfig::size; ++y) {
-		for (int x = 0; x < BoardConfig::size; ++x) {
-			ss << "|";
-			const auto& cell = map.getCell(x,y);
-			if (unit_cells.find(cell) != unit_cells.end()) {
-				ss << "a";		
-			} else {
-				ss << " ";
-			}			
-			if (cell->hasResource()) {
-				if (cell->resource.type==lux::ResourceType::wood) {
-					ss << 1;
-				} else if (cell->resource.type==lux::ResourceType::coal) { 
-					ss << 2;
-				} else {
-					ss << 3;
+#include "agent_io.hpp"
+#include "model_registry.hpp"
+
+using MainRandomEngine = RandomEngine<float, TrainConfig::train_seed>;
+
+// threaded actors only play one map size, see Trainer::runActor
+using TrainBoardSizes = std::conditional_t<
+	TrainConfig::train_all_board_sizes && BoardConfig::actor_count == 1,
+	BoardSizes, BoardSizeRegistry<BoardConfig::size>>;
+
+// the trainer of one map size and its frame count, the trainer built when a
+// game of that size first starts
+template <typename WorkerDQN, typename CityTileDQN> struct SizedTraining {
+	template <typename Board> struct Run {
+		using TrainerType = Trainer<Board::actor_count, TrainConfig::device,
+			MainRandomEngine &, WorkerDQN, CityTileDQN, Board>;
+		std::unique_ptr<TrainerType> m_trainer;
+		std::size_t m_frame = 0;
+	};
+	using Runs = typename TrainBoardSizes::template tuple_t<Run>;
+};
+
+template <typename WorkerDQN, typename CityTileDQN>
+static void train(char *membuf) {
+		using Training = SizedTraining<WorkerDQN, CityTileDQN>;
+		kit::Agent agent = kit::Agent();
+		auto &random_engine = MainRandomEngine::getInstance();
+		typename Training::Runs runs;
+		const auto run_for = [&](auto board_tag) -> auto & {
+			using Board = typename decltype(board_tag)::type;
+			auto &run = std::get<typename Training::template Run<Board>>(runs);
+			if (!run.m_trainer) {
+				run.m_trainer = std::make_unique<
+					typename Training::template Run<Board>::TrainerType>();
+				if constexpr (TrainConfig::resume_from_checkpoint) {
+					run.m_frame = run.m_trainer->resume(random_engine);
 				}
-			} else {
-				ss << 0;
+				run.m_trainer->startActors();
 			}
+			return run;
+		};
+		// the default size is up before the first game, as are its actors
+		run_for(board_tag<BoardConfig::size>{});
+
+		std::size_t game = 0;
+		int last_size = 0;
+		TurnScheduler turn(TrainConfig::turn_limit_ms, TrainConfig::turn_overage_ms,
+			TrainConfig::turn_safety_ms, TrainConfig::turn_deadline);
+		while (!wait_for_next_msg(membuf)) {}
+		while (true) {
+			game++;
+			turn.startGame();
+			initialize_game(agent, membuf);
+			const bool found = TrainBoardSizes::dispatch(agent.mapWidth, [&](auto board_tag) {
+				using Board = typename decltype(board_tag)::type;
+				auto &run = run_for(board_tag);
+				auto &trainer = *run.m_trainer;
+				if constexpr (is_size_invariant_model<WorkerDQN>::value) {
+					// carry the weights over from the size played last
+					TrainBoardSizes::dispatch(last_size, [&](auto last_tag) {
+						using LastBoard = typename decltype(last_tag)::type;
+						if constexpr (!std::is_same_v<Board, LastBoard>) {
+							trainer.shareWorkerWeights(*run_for(last_tag).m_trainer);
+						}
+					});
+				}
+				last_size = Board::size;
+
+				std::size_t episode = 0;
+				while (!wait_for_next_msg(membuf)) {
+					turn.startTurn(Board::episode_steps - 1 - agent.turn);
+					agent.updateServer(membuf);
+					print_board(agent);
+					const auto actions = trainer.processEpisode(agent, random_engine,
+						run.m_frame, episode, turn);
+					send_actions(agent, actions, membuf);
+					turn.endTurn();
+					std::cout << "sent actions: " << membuf << std::endl;
+					wait_for_client_to_forward_actions(membuf);
+					episode++; run.m_frame++;
+					std::cout << "completed episode: " << episode << std::endl;
+				}
 
-			if (cell->citytile != nullptr && cell->citytile->team==_env.id) {
-				ss << "A";
-			} else {
-				ss << " ";
+				trainer.resetState();
+				if constexpr (TrainConfig::checkpoint_interval > 0) {
+					if (game % TrainConfig::checkpoint_interval == 0) {
+						trainer.checkpoint(run.m_frame, random_engine);
+					}
+				}
+			});
+			if (!found) {
+				std::cerr << "unsupported map size " << agent.mapWidth
+					<< ", expected one of " << TrainBoardSizes::names() << std::endl;
+				exit(1);
 			}
 		}
-		ss << "|\n";	
-	}
-	std::cout << ss.str() << std::endl;
-}
-
-
-static inline bool wait_for_next_msg(char * membuf_) {
-	*membuf_ = ack_input_received;
-	while (*membuf_==ack_input_received) {};
-//	std::cout << "server received: " << membuf_ << std::endl;
-	return *membuf_==game_start_key;
-}
-
-static inline void wait_for_client_to_forward_actions(char * membuf_) {
-	while (*membuf_!=ack_actions_forwarded) {};
-}
-
-static inline void initialize_game(kit::Agent& agent_, char * membuf_) {
-	membuf_++; // game_start_key first
-	agent_.id = *membuf_ - '0';
-	membuf_++; // assumes agent id single digit
-	std::string map_info(membuf_);
-	std::vector<std::string> map_parts = kit::tokenize(map_info, " ");
-	agent_.mapWidth = std::stoi(map_parts[0]);
-	agent_.mapHeight = std::stoi(map_parts[1]);
-	agent_.map = lux::GameMap(agent_.mapWidth, agent_.mapHeight);
-	agent_.turn = 0;
-	std::cout << "initialized game: id " << agent_.id << ", " << agent_.mapWidth << ", " << agent_.mapHeight << std::endl;
-}
-
-template<typename ActionReturn>
-static inline void send_actions(
-	const kit::Agent& _agent, const ActionReturn& _actions, char * membuf_) {
-	std::stringstream ss;
-	ss << ack_inputs_processed;
-
-	const auto worker_actions = std::get<0>(_actions);
-	const auto ctile_actions = std::get<1>(_actions);
-	const auto& player = _agent.players[_agent.id];
-	const auto& workers = player.units;
-	const auto&	cities = player.cities;
-  
-	assert(workers.size() == worker_actions.size());
-	for (int i = 0; i < workers.size(); i++) {
-		const auto& unit = workers[i];
-		if (!unit.canAct()) continue;
-		if (i!=0) ss << ",";
-		const auto action = static_cast<WorkerActions>(worker_actions(i));
-		switch (action) {
-		case WorkerActions::CENTER:
-			ss << unit.move(lux::DIRECTIONS::CENTER);
-			break;
-		case WorkerActions::NORTH:
-			ss << unit.move(lux::DIRECTIONS::NORTH);
-			break;
-		case WorkerActions::EAST:
-			ss << unit.move(lux::DIRECTIONS::EAST);
-			break;
-		case WorkerActions::SOUTH:
-			ss << unit.move(lux::DIRECTIONS::SOUTH);
-			break;
-		case WorkerActions::WEST:
-			ss << unit.move(lux::DIRECTIONS::WEST);
-			break;
-//		case WorkerActions::PILLAGE:
-//			ss << unit.pillage();
-//			break;
-//		case WorkerActions::TRANSFER:
-//			assert(false);
-//			break;
-		case WorkerActions::BUILD:
-			ss << unit.buildCity();
-			break;
-		}
-	}
-
-	// TODO: massive fixme
-	int i = 0;
-	for (const auto& kv : cities) {
-		const auto& city = kv.second;
-		for (const auto& ctile : city.citytiles) {
-			if (!ctile.canAct()) continue;
-			if (i != 0) ss << ",";
-			const auto action = static_cast<CityTileActions>(ctile_actions(i++));
-			switch (action) {
-			case CityTileActions::BUILD_WORKER:
-				ss << ctile.buildWorker();
-				break;
-//			case CityTileActions::BUILD_CART:
-//				ss << ctile.buildCart();
-//				break;
-			case CityTileActions::RESEARCH:
-				ss << ctile.research();
-				break; 
-			}	
-		}
-	}	
-
-	ss << "\nD_FINISH\n";
-	const std::string str(ss.str());
-	const char * cstr = str.c_str();
-	strcpy(membuf_, cstr);
-} 
-
-static char * initialize_memory_map() {
-	int shmid;
-	char *membuf;
-
-	if ((shmid = shmget(key, buf_size, IPC_CREAT | 0666)) < 0) {
-			perror("shmget");
-			exit(1);
-	}
-
-	if ((membuf = (char *)shmat(shmid, NULL, 0)) == (char *) -1) {
-			perror("shmat");
-			exit(1);
-	}
-	return membuf;
 }
 
-
 int main() {
+		const auto models = read_model_selection(TrainConfig::model_config_path,
+			{TrainConfig::worker_model, TrainConfig::citytile_model});
+		std::cout << "worker model: " << models.m_worker
+			<< ", citytile model: " << models.m_citytile << std::endl;
 		char *membuf = initialize_memory_map();
-		kit::Agent agent = kit::Agent();
-		auto &random_engine = RandomEngine<float, TrainConfig::train_seed>::getInstance();
-		Trainer<BoardConfig::actor_count, TrainConfig::device, decltype(random_engine)> trainer; 
-		
-		std::size_t episode = 0;
-		std::size_t frame = 0;
-		while (true) {
-			bool is_new_game = wait_for_next_msg(membuf);
-
-			if (is_new_game)	{
-				trainer.resetState();
-				initialize_game(agent, membuf);
-				episode = 0;
-				continue;
-			}
-			agent.updateServer(membuf);
-			print_board(agent);
-			const auto actions = trainer.processEpisode(agent, random_engine, frame, episode);
-			send_actions(agent, actions, membuf);
-			std::cout << "sent actions: " << membuf << std::endl;					
-			wait_for_client_to_forward_actions(membuf);
-			episode++; frame++;
-			std::cout << "completed episode: " << episode << std::endl;
-		}
+		dispatch_models(models, [membuf](auto worker_tag, auto citytile_tag) {
+			train<typename decltype(worker_tag)::type,
+				typename decltype(citytile_tag)::type>(membuf);
+		});
     return 0;
 }
@@ -10,6 +10,9 @@
 
 #include <Eigen/Dense>
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
 #include <torch/torch.h>
 
 static inline int manhattan(const int _x1, const int _y1, const int _x2,
@@ -138,6 +141,18 @@ template <typename T> static inline T clip(T value, T lower, T upper) {
   return value < lower ? lower : value > upper ? upper : value;
 }
 
+// Ape-X end epsilon of actor _actor out of _actor_count, spread
+// geometrically from _epsilon down to _epsilon^(1 + _alpha)
+static inline float apex_epsilon(const std::size_t _actor,
+                                 const std::size_t _actor_count,
+                                 const float _epsilon, const float _alpha) {
+  if (_actor_count < 2) {
+    return _epsilon;
+  }
+  return std::pow(_epsilon, 1 + _alpha * _actor /
+                                    static_cast<float>(_actor_count - 1));
+}
+
 template <typename ScalarType, typename Derived>
 static inline void eigen_to_tensor(const Derived &_eigen,
                                    torch::Tensor &tensor_) {
@@ -152,6 +167,33 @@ static inline void tensor_to_eigen(const torch::Tensor &_tensor,
               sizeof(ScalarType) * _tensor.size(0));
 }
 
+// [n] action bitmasks, bit a set when action a is legal -> [n, actions] bool
+static inline torch::Tensor expand_action_mask(const torch::Tensor &_bits,
+                                               const int64_t _action_count) {
+  const auto action_bits =
+      torch::pow(2, torch::arange(_action_count, _bits.options()));
+  return torch::bitwise_and(_bits.unsqueeze(1), action_bits).ne(0);
+}
+
+// argmax over dim 1 restricted to the legal actions of each row
+static inline torch::Tensor masked_argmax(const torch::Tensor &_values,
+                                          const torch::Tensor &_legal) {
+  return _values
+      .masked_fill(_legal.logical_not(),
+                   -std::numeric_limits<float>::infinity())
+      .argmax(1);
+}
+
+// the _k best legal actions per row in descending order, (values, actions);
+// ranks past the legal actions hold -inf
+static inline std::tuple<torch::Tensor, torch::Tensor>
+masked_topk(const torch::Tensor &_values, const torch::Tensor &_legal,
+            const int64_t _k) {
+  return torch::topk(_values.masked_fill(_legal.logical_not(),
+                                         -std::numeric_limits<float>::infinity()),
+                     _k, 1);
+}
+
 static inline void choice(const std::size_t _sample_space_size,
                           torch::Tensor &p_, torch::Tensor &draws_,
                           torch::Tensor &indices_) {
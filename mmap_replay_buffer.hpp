@@ -0,0 +1,382 @@
+#ifndef MMAP_REPLAY_BUFFER_HPP_
+#define MMAP_REPLAY_BUFFER_HPP_
+
+#include "math_util.hpp"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <torch/torch.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// file layout: header, then one column per transition field. every column
+// is 64 byte aligned so the torch views below can be handed to
+// index_select/index_copy_ directly.
+struct MMapReplayHeader {
+  static constexpr uint64_t magic = 0x4c55585245504c59; // "LUXREPLY"
+  static constexpr uint32_t version = 3;
+
+  uint64_t m_magic;
+  uint32_t m_version;
+  uint32_t m_capacity;
+  uint64_t m_geometric_size;
+  uint64_t m_temporal_size;
+  uint32_t m_pos;
+  uint32_t m_size;
+};
+
+static inline std::size_t mmap_align(const std::size_t _bytes) {
+  return (_bytes + 63) & ~static_cast<std::size_t>(63);
+}
+
+// Prioritized replay whose transition columns, priorities and cursor live in
+// a memory mapped file. Reopening the same file restores the buffer without
+// any deserialization, and the page cache decides residency, so capacity is
+// not bound by RAM. Drop in replacement for ReplayBuffer.
+template <torch::DeviceType DeviceType, typename BatchType,
+          typename ExampleType>
+class MMapReplayBuffer {
+public:
+  static constexpr bool is_persistent = true;
+  static constexpr bool is_thread_safe = false;
+
+  MMapReplayBuffer(const unsigned _capacity, const unsigned _batch_size,
+                   const float _alpha, const float _beta,
+                   const float _beta_decay, const std::string &_path)
+      : m_capacity(_capacity), m_batch_size(_batch_size), m_alpha(_alpha),
+        m_beta(_beta), m_beta_decay(_beta_decay),
+        m_geometric_size(ExampleType::state_t::geometric_size),
+        m_temporal_size(ExampleType::state_t::temporal_size),
+        m_cumsum(Eigen::ArrayXf::Zero(_capacity)), m_choices(_batch_size),
+        m_batch(_batch_size), m_fd(-1), m_map_size(0), m_map(nullptr),
+        m_header(nullptr), m_prios(nullptr, 0),
+        m_choices_on_cpu(
+            torch::zeros({_batch_size}, torch::dtype(torch::kInt64)
+                                            .requires_grad(false)
+                                            .device(torch::kCPU))),
+        m_weights_on_cpu(
+            torch::zeros({_batch_size}, torch::dtype(torch::kFloat32)
+                                            .requires_grad(false)
+                                            .device(torch::kCPU))) {
+    openMap(_path);
+  }
+
+  MMapReplayBuffer(const MMapReplayBuffer &) = delete;
+  MMapReplayBuffer &operator=(const MMapReplayBuffer &) = delete;
+
+  ~MMapReplayBuffer() {
+    if (m_map != nullptr) {
+      msync(m_map, m_map_size, MS_ASYNC);
+      munmap(m_map, m_map_size);
+    }
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+  }
+
+  inline std::size_t size() const { return m_header->m_size; }
+  inline std::size_t getPos() const { return m_header->m_pos; }
+  inline const Eigen::Ref<const Eigen::ArrayXf> getPrios() const {
+    return m_prios.head(m_header->m_size);
+  }
+
+  inline bool isCapacityReached() const {
+    return m_header->m_size == m_capacity;
+  }
+
+  inline void flush() const { msync(m_map, m_map_size, MS_SYNC); }
+
+  // The mapped file keeps moving after a checkpoint, so the archive gets its
+  // own copy of the stored rows, priorities and cursor: a resume pairs them
+  // with the networks and RNGs of the same moment. The clones are memcpys,
+  // serializing them is left to the checkpoint writer, and the file itself
+  // is only scheduled for write back.
+  void save(torch::serialize::OutputArchive &archive_) const {
+    const int64_t size = m_header->m_size;
+    for (const auto &column : columns()) {
+      archive_.write(column.first, column.second.narrow(0, 0, size).clone());
+    }
+    archive_.write("prios",
+                   torch::from_blob(const_cast<float *>(m_prios.data()), {size})
+                       .clone());
+    archive_.write("pos", torch::tensor(static_cast<int64_t>(m_header->m_pos)));
+    archive_.write("size", torch::tensor(size));
+    msync(m_map, m_map_size, MS_ASYNC);
+  }
+
+  void load(torch::serialize::InputArchive &archive_) {
+    torch::Tensor loaded, size, pos;
+    archive_.read("size", size);
+    archive_.read("pos", pos);
+    const int64_t rows = std::min<int64_t>(size.item<int64_t>(), m_capacity);
+    for (auto &column : columns()) {
+      archive_.read(column.first, loaded);
+      column.second.narrow(0, 0, rows).copy_(loaded.narrow(0, 0, rows));
+    }
+    archive_.read("prios", loaded);
+    std::memcpy(m_prios.data(), loaded.data_ptr<float>(), sizeof(float) * rows);
+    m_header->m_pos = static_cast<uint32_t>(pos.item<int64_t>() % m_capacity);
+    m_header->m_size = static_cast<uint32_t>(rows);
+  }
+
+  inline unsigned getBatchSize() const { return m_batch_size; }
+
+  template <typename RandomEngine>
+  const BatchType &sample(RandomEngine &random_engine_, const unsigned _frame) {
+    sampleInto(random_engine_, _frame, m_batch, m_choices);
+    return m_batch;
+  }
+
+  template <typename RandomEngine>
+  void sampleInto(RandomEngine &random_engine_, const unsigned _frame,
+                  BatchType &batch_, Eigen::Ref<Eigen::ArrayXi> choices_) {
+    const auto prios = m_prios.head(m_header->m_size);
+    Eigen::ArrayXf probs = prios.pow(m_alpha);
+    probs /= probs.sum();
+    choice(random_engine_, probs, m_cumsum.head(probs.size()), choices_);
+
+    const auto weights =
+        (probs.size() * probs)
+            .pow(-std::min(1.f, m_beta + _frame * (1 - m_beta) / m_beta_decay));
+    auto choices_a = m_choices_on_cpu.accessor<int64_t, 1>();
+    auto weights_a = m_weights_on_cpu.accessor<float, 1>();
+    for (unsigned i = 0; i < m_batch_size; ++i) {
+      choices_a[i] = choices_(i);
+      weights_a[i] = weights(choices_(i));
+    }
+
+    gather(m_state_geometric, batch_.m_state.m_geometric);
+    gather(m_state_temporal, batch_.m_state.m_temporal);
+    gather(m_state_positions, batch_.m_state.m_positions);
+    gather(m_state_legal, batch_.m_state.m_legal);
+    gather(m_next_state_geometric, batch_.m_next_state.m_geometric);
+    gather(m_next_state_temporal, batch_.m_next_state.m_temporal);
+    gather(m_next_state_positions, batch_.m_next_state.m_positions);
+    gather(m_next_state_legal, batch_.m_next_state.m_legal);
+    gather(m_action, batch_.m_action);
+    gather(m_reward, batch_.m_reward);
+    gather(m_is_non_terminal, batch_.m_is_non_terminal);
+    batch_.m_weights.copy_(m_weights_on_cpu);
+  }
+
+  void updatePrios(const torch::Tensor &_prios) {
+    updatePrios(_prios, m_choices);
+  }
+
+  void updatePrios(const torch::Tensor &_prios,
+                   const Eigen::Ref<const Eigen::ArrayXi> &_choices) {
+    auto prios_cpu = _prios.cpu().squeeze();
+    auto a = prios_cpu.accessor<float, 1>();
+    for (unsigned i = 0; i < m_batch_size; ++i) {
+      m_prios(_choices(i)) = a[i];
+    }
+  }
+
+  void push(const BatchType &_batch, const std::size_t _obj_count) {
+    if (_obj_count == 0) {
+      return;
+    }
+    const float max_prio =
+        m_header->m_size > 0 ? m_prios.head(m_header->m_size).maxCoeff() : 1;
+    const auto positions =
+        torch::arange(static_cast<int64_t>(m_header->m_pos),
+                      static_cast<int64_t>(m_header->m_pos + _obj_count),
+                      torch::dtype(torch::kInt64))
+            .remainder_(static_cast<int64_t>(m_capacity));
+    const auto up_to_count =
+        torch::indexing::Slice(0, static_cast<int64_t>(_obj_count), 1);
+
+    scatter(_batch.m_state.m_geometric, positions, up_to_count,
+            m_state_geometric);
+    scatter(_batch.m_state.m_temporal, positions, up_to_count,
+            m_state_temporal);
+    scatter(_batch.m_state.m_positions, positions, up_to_count,
+            m_state_positions);
+    scatter(_batch.m_state.m_legal, positions, up_to_count, m_state_legal);
+    scatter(_batch.m_next_state.m_geometric, positions, up_to_count,
+            m_next_state_geometric);
+    scatter(_batch.m_next_state.m_temporal, positions, up_to_count,
+            m_next_state_temporal);
+    scatter(_batch.m_next_state.m_positions, positions, up_to_count,
+            m_next_state_positions);
+    scatter(_batch.m_next_state.m_legal, positions, up_to_count,
+            m_next_state_legal);
+    scatter(_batch.m_action, positions, up_to_count, m_action);
+    scatter(_batch.m_reward, positions, up_to_count, m_reward);
+    scatter(_batch.m_is_non_terminal, positions, up_to_count,
+            m_is_non_terminal);
+
+    for (std::size_t i = 0; i < _obj_count; ++i) {
+      m_prios((m_header->m_pos + i) % m_capacity) = max_prio;
+    }
+    m_header->m_pos = (m_header->m_pos + _obj_count) % m_capacity;
+    m_header->m_size = std::min<std::size_t>(m_header->m_size + _obj_count,
+                                             m_capacity);
+  }
+
+private:
+  inline void gather(const torch::Tensor &_column, torch::Tensor &batch_) {
+    if (DeviceType == torch::kCPU) {
+      torch::index_select_out(batch_, _column, 0, m_choices_on_cpu);
+    } else {
+      batch_.copy_(_column.index_select(0, m_choices_on_cpu));
+    }
+  }
+
+  static inline void scatter(const torch::Tensor &_batch,
+                             const torch::Tensor &_positions,
+                             const torch::indexing::Slice &_up_to_count,
+                             torch::Tensor &column_) {
+    column_.index_copy_(
+        0, _positions,
+        _batch.index({_up_to_count}).to(torch::kCPU).to(column_.dtype()));
+  }
+
+  void openMap(const std::string &_path) {
+    const std::size_t geometric_bytes =
+        mmap_align(sizeof(float) * m_capacity * m_geometric_size);
+    const std::size_t temporal_bytes =
+        mmap_align(sizeof(float) * m_capacity * m_temporal_size);
+    const std::size_t header_bytes = mmap_align(sizeof(MMapReplayHeader));
+    const std::size_t action_bytes = mmap_align(sizeof(int64_t) * m_capacity);
+    const std::size_t scalar_bytes = mmap_align(sizeof(float) * m_capacity);
+    const std::size_t flag_bytes = mmap_align(sizeof(bool) * m_capacity);
+    m_map_size = header_bytes +
+                 2 * (geometric_bytes + temporal_bytes + 2 * action_bytes) +
+                 action_bytes + 2 * scalar_bytes + flag_bytes;
+
+    if ((m_fd = open(_path.c_str(), O_RDWR | O_CREAT, 0666)) < 0) {
+      perror("open");
+      exit(1);
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) < 0) {
+      perror("fstat");
+      exit(1);
+    }
+    const bool existing = static_cast<std::size_t>(st.st_size) == m_map_size;
+    if (!existing && ftruncate(m_fd, m_map_size) < 0) {
+      perror("ftruncate");
+      exit(1);
+    }
+    m_map = static_cast<char *>(
+        mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0));
+    if (m_map == MAP_FAILED) {
+      m_map = nullptr;
+      perror("mmap");
+      exit(1);
+    }
+
+    m_header = reinterpret_cast<MMapReplayHeader *>(m_map);
+    const bool compatible =
+        existing && m_header->m_magic == MMapReplayHeader::magic &&
+        m_header->m_version == MMapReplayHeader::version &&
+        m_header->m_capacity == m_capacity &&
+        m_header->m_geometric_size == m_geometric_size &&
+        m_header->m_temporal_size == m_temporal_size;
+    if (!compatible) {
+      std::memset(m_map, 0, m_map_size);
+      m_header->m_magic = MMapReplayHeader::magic;
+      m_header->m_version = MMapReplayHeader::version;
+      m_header->m_capacity = m_capacity;
+      m_header->m_geometric_size = m_geometric_size;
+      m_header->m_temporal_size = m_temporal_size;
+      m_header->m_pos = 0;
+      m_header->m_size = 0;
+    }
+    std::cout << "replay " << _path << (compatible ? " restored " : " created ")
+              << m_header->m_size << "/" << m_capacity << std::endl;
+
+    char *cursor = m_map + header_bytes;
+    m_state_geometric = column(cursor, m_batch.m_state.m_geometric, geometric_bytes);
+    m_state_temporal = column(cursor, m_batch.m_state.m_temporal, temporal_bytes);
+    m_state_positions =
+        column(cursor, m_batch.m_state.m_positions, action_bytes);
+    m_state_legal = column(cursor, m_batch.m_state.m_legal, action_bytes);
+    m_next_state_geometric =
+        column(cursor, m_batch.m_next_state.m_geometric, geometric_bytes);
+    m_next_state_temporal =
+        column(cursor, m_batch.m_next_state.m_temporal, temporal_bytes);
+    m_next_state_positions =
+        column(cursor, m_batch.m_next_state.m_positions, action_bytes);
+    m_next_state_legal =
+        column(cursor, m_batch.m_next_state.m_legal, action_bytes);
+    m_action = column(cursor, m_batch.m_action, action_bytes);
+    m_reward = column(cursor, m_batch.m_reward, scalar_bytes);
+    m_is_non_terminal = column(cursor, m_batch.m_is_non_terminal, flag_bytes);
+    new (&m_prios) Eigen::Map<Eigen::ArrayXf>(
+        reinterpret_cast<float *>(cursor), m_capacity);
+  }
+
+  // every column by archive name, views into the mapping
+  inline std::vector<std::pair<const char *, torch::Tensor>> columns() const {
+    return {{"state_geometric", m_state_geometric},
+            {"state_temporal", m_state_temporal},
+            {"state_positions", m_state_positions},
+            {"state_legal", m_state_legal},
+            {"next_state_geometric", m_next_state_geometric},
+            {"next_state_temporal", m_next_state_temporal},
+            {"next_state_positions", m_next_state_positions},
+            {"next_state_legal", m_next_state_legal},
+            {"action", m_action},
+            {"reward", m_reward},
+            {"is_non_terminal", m_is_non_terminal}};
+  }
+
+  // non-owning view over the next column, shaped like the batch tensor
+  // with the batch dimension replaced by capacity
+  inline torch::Tensor column(char *&cursor_, const torch::Tensor &_like,
+                              const std::size_t _bytes) {
+    auto sizes = _like.sizes().vec();
+    sizes[0] = m_capacity;
+    auto view = torch::from_blob(
+        cursor_, sizes,
+        torch::dtype(_like.scalar_type()).requires_grad(false).device(torch::kCPU));
+    cursor_ += _bytes;
+    return view;
+  }
+
+private:
+  unsigned m_capacity;
+  unsigned m_batch_size;
+  float m_alpha;
+  float m_beta;
+  float m_beta_decay;
+  std::size_t m_geometric_size;
+  std::size_t m_temporal_size;
+  Eigen::ArrayXf m_cumsum;
+  Eigen::ArrayXi m_choices;
+  BatchType m_batch;
+
+  int m_fd;
+  std::size_t m_map_size;
+  char *m_map;
+  MMapReplayHeader *m_header;
+  Eigen::Map<Eigen::ArrayXf> m_prios;
+
+  torch::Tensor m_state_geometric;
+  torch::Tensor m_state_temporal;
+  torch::Tensor m_state_positions;
+  torch::Tensor m_state_legal;
+  torch::Tensor m_next_state_geometric;
+  torch::Tensor m_next_state_temporal;
+  torch::Tensor m_next_state_positions;
+  torch::Tensor m_next_state_legal;
+  torch::Tensor m_action;
+  torch::Tensor m_reward;
+  torch::Tensor m_is_non_terminal;
+
+  torch::Tensor m_choices_on_cpu;
+  torch::Tensor m_weights_on_cpu;
+};
+
+#endif /* MMAP_REPLAY_BUFFER_HPP_ */
@@ -8,6 +8,9 @@
 #ifndef MODEL_CONFIG_HPP_
 #define MODEL_CONFIG_HPP_
 
+#include <cstddef>
+#include <cstdint>
+
 struct BaseModelConfig {};
 
 struct WorkerModelConfig : public BaseModelConfig {
@@ -43,5 +46,9 @@ struct CityTileModelConfig : public BaseModelConfig {
   constexpr static std::size_t output_size = 3;
 };
 
+// action bitmask with every output of the model legal
+template <typename ModelConfig>
+constexpr int64_t all_actions_legal =
+    (static_cast<int64_t>(1) << ModelConfig::output_size) - 1;
 
 #endif /* MODEL_CONFIG_HPP_ */
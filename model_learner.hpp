@@ -8,37 +8,20 @@
 #ifndef MODEL_LEARNER_HPP_
 #define MODEL_LEARNER_HPP_
 
+#include "categorical_projection.hpp"
+#include "checkpoint.hpp"
 #include "dqn.hpp"
+#include "flat_parameters.hpp"
 #include "hyper_parameters.hpp"
+#include "math_util.hpp"
 #include <chrono>
 #include <torch/torch.h>
 
-template <typename Model>
-static void copy_state_dict(Model &to_, const Model &_from) {
-  torch::autograd::GradMode::set_enabled(false);
-  auto update_params = to_.named_parameters(true);
-  auto update_buffers = to_.named_buffers(true);
-  const auto copy_params = _from.named_parameters(true /*recurse*/);
-  const auto copy_buffers = _from.named_buffers(true /*recurse*/);
-
-  for (const auto &kv : copy_params) {
-    auto *tensor = update_params.find(kv.key());
-    if (tensor != nullptr) {
-      tensor->copy_(kv.value());
-    }
-  }
-
-  for (const auto &kv : copy_buffers) {
-    auto *tensor = update_buffers.find(kv.key());
-    if (tensor != nullptr) {
-      tensor->copy_(kv.value());
-    }
-  }
-  torch::autograd::GradMode::set_enabled(true);
-}
-
+// StackedForward runs state and next_state through the dynamic network as
+// one 2x batch and detaches the next_state half for double DQN selection.
+// With BatchNorm the batch statistics then span both halves.
 template <typename DQN, torch::DeviceType DeviceType,
-          std::size_t action_space_size>
+          std::size_t action_space_size, bool StackedForward = false>
 class ModelLearner {
 public:
   template <typename... Args>
@@ -46,6 +29,7 @@ public:
       : m_batch_size(HyperParameters::m_replay_batch_size), m_vmin(HyperParameters::m_nn_v_min),
         m_vmax(HyperParameters::m_nn_v_max), m_atom_count(HyperParameters::m_nn_atom_count),
         m_target_model_update(HyperParameters::m_nn_target_model_update),
+        m_target_tau(HyperParameters::m_nn_target_tau),
         m_gamma(std::pow(HyperParameters::m_nn_gamma,HyperParameters::m_nn_step_size)), m_lr(HyperParameters::m_nn_lr),
         m_momentum(HyperParameters::m_nn_momentum), m_weight_decay(HyperParameters::m_nn_weight_decay),
         m_delta_z((HyperParameters::m_nn_v_max - HyperParameters::m_nn_v_min) /
@@ -73,7 +57,10 @@ public:
                          .requires_grad(false))
                      .unsqueeze(1)
                      .expand({m_batch_size, m_atom_count})) {
+    m_dqn_dynamic.to(DeviceType);
     m_dqn_target.to(DeviceType);
+    m_flat_dynamic.bind(m_dqn_dynamic);
+    m_flat_target.bind(m_dqn_target);
     updateTargetModel();
   };
 
@@ -82,8 +69,30 @@ public:
                     RandomEngine &random_engine_) {
     auto &mini_batch = _replay_buffer.sample(random_engine_, _frame);
 
-    torch::Tensor forward =
-        m_dqn_dynamic.forward(mini_batch.m_state.m_geometric);
+    torch::Tensor forward;
+    torch::Tensor next_forward;
+    if constexpr (StackedForward) {
+      torch::Tensor stacked;
+      if constexpr (is_board_model<DQN>::value) {
+        stacked = m_dqn_dynamic.forward(
+            torch::cat({mini_batch.m_state.m_geometric,
+                        mini_batch.m_next_state.m_geometric},
+                       0),
+            torch::cat({mini_batch.m_state.m_positions,
+                        mini_batch.m_next_state.m_positions},
+                       0));
+      } else {
+        stacked = m_dqn_dynamic.forward(
+            torch::cat({mini_batch.m_state.m_geometric,
+                        mini_batch.m_next_state.m_geometric},
+                       0));
+      }
+      auto halves = stacked.split(m_batch_size, 0);
+      forward = halves[0];
+      next_forward = halves[1].detach();
+    } else {
+      forward = forward_state(m_dqn_dynamic, mini_batch.m_state);
+    }
 
     torch::Tensor current_dist =
         forward
@@ -91,7 +100,7 @@ public:
                            {m_batch_size, 1, m_atom_count}))
             .squeeze(1);
 
-    computeTargetDistribution(mini_batch);
+    computeTargetDistribution(mini_batch, next_forward);
 
     torch::Tensor loss = -(m_target_distribution * current_dist.log()).sum(1);
 
@@ -109,7 +118,9 @@ public:
 
     _replay_buffer.updatePrios(loss.detach());
 
-    if ((m_reps + 1) % m_target_model_update == 0) {
+    if (m_target_tau > 0) {
+      m_flat_target.lerpFrom(m_flat_dynamic, m_target_tau);
+    } else if ((m_reps + 1) % m_target_model_update == 0) {
       std::cout << "updated target model" << std::endl;
       updateTargetModel();
     }
@@ -118,24 +129,89 @@ public:
     m_reps++;
   }
 
+  // after the dynamic network switched to channels_last: the target follows
+  // and both flat buffers are rebound to the new storage
+  void toChannelsLast() {
+    if constexpr (has_channels_last<DQN>::value) {
+      m_dqn_target.toChannelsLast();
+      m_flat_dynamic.bind(m_dqn_dynamic);
+      m_flat_target.bind(m_dqn_target);
+    }
+  }
+
+  // independent noise streams for the dynamic and target networks
+  void seedNoise(const uint64_t _seed) {
+    if constexpr (has_factorized_noise<DQN>::value) {
+      m_dqn_dynamic.m_noise.seed(_seed);
+      m_dqn_target.m_noise.seed(_seed + 1);
+    }
+  }
+
+  // target network, optimizer momentum and the step count that schedules
+  // target updates; the dynamic network is saved by its owner
+  void save(torch::serialize::OutputArchive &archive_) {
+    torch::serialize::OutputArchive target, optimizer;
+    save_module_state(target, m_dqn_target);
+    save_sgd_state(optimizer, m_optimizer);
+    archive_.write("target", target);
+    archive_.write("optimizer", optimizer);
+    archive_.write("reps", torch::tensor(static_cast<int64_t>(m_reps)));
+    if constexpr (has_factorized_noise<DQN>::value) {
+      archive_.write("dynamic_noise",
+                     m_dqn_dynamic.m_noise.getGenerator().get_state());
+      archive_.write("target_noise",
+                     m_dqn_target.m_noise.getGenerator().get_state());
+    }
+  }
+
+  void load(torch::serialize::InputArchive &archive_) {
+    torch::serialize::InputArchive target, optimizer;
+    torch::Tensor reps;
+    archive_.read("target", target);
+    archive_.read("optimizer", optimizer);
+    archive_.read("reps", reps);
+    load_module_state(target, m_dqn_target);
+    load_sgd_state(optimizer, m_optimizer);
+    m_reps = reps.item<int64_t>();
+    if constexpr (has_factorized_noise<DQN>::value) {
+      torch::Tensor dynamic_noise, target_noise;
+      archive_.read("dynamic_noise", dynamic_noise);
+      archive_.read("target_noise", target_noise);
+      m_dqn_dynamic.m_noise.getGenerator().set_state(dynamic_noise.cpu());
+      m_dqn_target.m_noise.getGenerator().set_state(target_noise.cpu());
+    }
+  }
+
+  // online and target weights of another learner of the same architecture,
+  // e.g. one training on another board size
+  void inline copyWeightsFrom(const ModelLearner &_other) {
+    m_flat_dynamic.copyFrom(_other.m_flat_dynamic);
+    m_flat_target.copyFrom(_other.m_flat_target);
+  }
+
 private:
   template <typename BatchType>
-  void inline computeTargetDistribution(const BatchType &_mini_batch) {
+  void inline computeTargetDistribution(const BatchType &_mini_batch,
+                                        const torch::Tensor &_next_forward) {
     torch::NoGradGuard no_grad;
-    m_target_distribution.zero_();
 
     auto dynamic_probabilities =
-        m_dqn_dynamic.forward(_mini_batch.m_next_state.m_geometric);
+        _next_forward.defined()
+            ? _next_forward
+            : forward_state(m_dqn_dynamic, _mini_batch.m_next_state);
 
     auto dynamic_distribution = dynamic_probabilities * m_support;
 
-    auto dynamic_selection = std::get<1>(dynamic_distribution.sum(2).max(1))
+    // select only among the next state's legal actions, as the actor does
+    const auto next_legal = expand_action_mask(
+        _mini_batch.m_next_state.m_legal, dynamic_distribution.size(1));
+    auto dynamic_selection = masked_argmax(dynamic_distribution.sum(2), next_legal)
                                  .unsqueeze(1)
                                  .unsqueeze(1)
                                  .expand({m_batch_size, 1, m_atom_count});
 
-    auto target_probabilities = m_dqn_target.forward(
-        _mini_batch.m_next_state.m_geometric); // care for  * support bug here
+    auto target_probabilities = forward_state(
+        m_dqn_target, _mini_batch.m_next_state); // care for  * support bug here
 
     auto target_selection =
         target_probabilities.gather(1, dynamic_selection).squeeze(1);
@@ -145,12 +221,6 @@ private:
     //			_mini_batch.m_is_non_terminal.cpu().unsqueeze(1).expand_as(target_selection)
     //* m_gamma * m_support.unsqueeze(0).expand_as(target_selection);
 
-    auto Tz = _mini_batch.m_reward.unsqueeze(1) +
-              _mini_batch.m_is_non_terminal.unsqueeze(1) * m_gamma *
-                  m_support.unsqueeze(0);
-
-    Tz.clamp_(m_vmin, m_vmax);
-		
 		std::cout << "actions:" << std::endl;
 		std::cout << _mini_batch.m_action << std::endl;
 
@@ -163,31 +233,19 @@ private:
 		std::cout << "next state: " << std::endl;
 		std::cout << _mini_batch.m_next_state.m_geometric.index({15,2,0,0});	
 
-    torch::Tensor b = (Tz - m_vmin) / m_delta_z;
-
-    torch::Tensor l = b.floor().to(torch::kInt32);
-    torch::Tensor u = b.ceil().to(torch::kInt32);
-
-
-    torch::Tensor same_index_mask = l == b;
-    torch::Tensor mask_for_lowers = (u > 0) * same_index_mask;
-    torch::Tensor mask_for_uppers =
-        (l < (static_cast<int>(m_atom_count) - 1)) * same_index_mask;
-    l.index_put_({mask_for_lowers}, (l - 1).index({mask_for_lowers}));
-    u.index_put_({mask_for_uppers}, (u + 1).index({mask_for_uppers}));
-
-
-    m_target_distribution.view({-1}).index_add_(
-        0, (l + m_offset).view({-1}),
-        (target_selection * (u.to(torch::kFloat32) - b)).view({-1}));
-    m_target_distribution.view({-1}).index_add_(
-        0, (u + m_offset).view({-1}),
-        (target_selection * (b - l.to(torch::kFloat32))).view({-1}));
+    if constexpr (DeviceType == torch::kCPU) {
+      project_categorical(_mini_batch.m_reward, _mini_batch.m_is_non_terminal,
+                          target_selection, m_gamma, m_vmin, m_vmax,
+                          m_target_distribution);
+    } else {
+      project_categorical_reference(
+          _mini_batch.m_reward, _mini_batch.m_is_non_terminal,
+          target_selection, m_support, m_offset, m_gamma, m_vmin, m_vmax,
+          m_target_distribution);
+    }
   }
 
-  void inline updateTargetModel() {
-    copy_state_dict(m_dqn_target, m_dqn_dynamic);
-  }
+  void inline updateTargetModel() { m_flat_target.copyFrom(m_flat_dynamic); }
 
   void inline report() {
     std::cout << "reps: " << m_reps << " avg ms: "
@@ -201,6 +259,7 @@ private:
   float m_vmin;
   float m_vmax;
   std::size_t m_target_model_update;
+  float m_target_tau;
   float m_gamma;
   float m_lr;
   float m_momentum;
@@ -211,6 +270,8 @@ private:
 
   DQN &m_dqn_dynamic;
   DQN m_dqn_target;
+  FlatParameters m_flat_dynamic;
+  FlatParameters m_flat_target;
   torch::optim::SGD m_optimizer;
   torch::Tensor m_support;
   torch::Tensor m_offset;
@@ -0,0 +1,116 @@
+#ifndef MODEL_REGISTRY_HPP_
+#define MODEL_REGISTRY_HPP_
+
+#include "dqn.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Architectures selectable at startup by name. Selection is runtime, but
+// dispatch hands the caller the concrete type, so everything downstream
+// (Trainer, learner, actor) is instantiated per model and keeps statically
+// dispatched forwards. Adding a model is a model_name specialization plus
+// an entry in the matching registry; every entry is compiled in, so
+// switching between them needs no rebuild.
+template <typename Model> struct model_name;
+template <> struct model_name<BigDQN> {
+  static constexpr const char *value = "BigDQN";
+};
+template <> struct model_name<BoardDQN> {
+  static constexpr const char *value = "BoardDQN";
+};
+template <> struct model_name<SmallDQN> {
+  static constexpr const char *value = "SmallDQN";
+};
+template <> struct model_name<LinearOnlyDQN> {
+  static constexpr const char *value = "LinearOnlyDQN";
+};
+template <> struct model_name<ConvOnlyDQN> {
+  static constexpr const char *value = "ConvOnlyDQN";
+};
+
+template <typename Model> struct model_tag { using type = Model; };
+
+template <typename... Models> struct ModelRegistry {
+  // calls f(model_tag<Model>{}) for the model registered as _name, false if
+  // there is none
+  template <typename F> static bool dispatch(const std::string &_name, F &&f) {
+    return ((_name == model_name<Models>::value &&
+             (f(model_tag<Models>{}), true)) ||
+            ...);
+  }
+
+  static std::string names() {
+    std::string names;
+    ((names += std::string(names.empty() ? "" : ", ") +
+               model_name<Models>::value),
+     ...);
+    return names;
+  }
+};
+
+// distributional models, (channels, size, actions, std_init, atoms, v_min,
+// v_max) -> [batch, actions, atoms]
+using WorkerModelRegistry = ModelRegistry<BigDQN, BoardDQN>;
+// plain Q models, (channels, size, actions) -> [batch, actions]
+using CityTileModelRegistry =
+    ModelRegistry<SmallDQN, LinearOnlyDQN, ConvOnlyDQN>;
+
+struct ModelSelection {
+  std::string m_worker;
+  std::string m_citytile;
+};
+
+// "key = value" lines, '#' starts a comment. A missing file or key keeps the
+// defaults passed in.
+static ModelSelection read_model_selection(const std::string &_path,
+                                           ModelSelection selection_) {
+  std::ifstream file(_path);
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    const auto equals = line.find('=');
+    if (equals == std::string::npos) {
+      continue;
+    }
+    std::string key, value;
+    std::istringstream(line.substr(0, equals)) >> key;
+    std::istringstream(line.substr(equals + 1)) >> value;
+    if (key == "worker_model") {
+      selection_.m_worker = value;
+    } else if (key == "citytile_model") {
+      selection_.m_citytile = value;
+    } else if (!key.empty()) {
+      std::cerr << _path << ": unknown key " << key << std::endl;
+    }
+  }
+  return selection_;
+}
+
+// f(model_tag<WorkerDQN>{}, model_tag<CityTileDQN>{}); exits on a name that
+// is not registered
+template <typename F>
+static void dispatch_models(const ModelSelection &_selection, F &&f) {
+  const bool found = WorkerModelRegistry::dispatch(
+      _selection.m_worker, [&](auto worker_tag_) {
+        const bool found = CityTileModelRegistry::dispatch(
+            _selection.m_citytile,
+            [&](auto citytile_tag_) { f(worker_tag_, citytile_tag_); });
+        if (!found) {
+          std::cerr << "unknown citytile_model " << _selection.m_citytile
+                    << ", expected one of " << CityTileModelRegistry::names()
+                    << std::endl;
+          exit(1);
+        }
+      });
+  if (!found) {
+    std::cerr << "unknown worker_model " << _selection.m_worker
+              << ", expected one of " << WorkerModelRegistry::names()
+              << std::endl;
+    exit(1);
+  }
+}
+
+#endif /* MODEL_REGISTRY_HPP_ */
@@ -0,0 +1,179 @@
+#ifndef PREFETCH_SAMPLER_HPP_
+#define PREFETCH_SAMPLER_HPP_
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <torch/torch.h>
+#include <vector>
+
+// Wraps a prioritized replay buffer with a worker thread that samples the
+// next PrefetchCount batches while the learner trains on the current one.
+// Priority updates are queued and applied in order before the worker draws
+// its next batch, so results only differ from synchronous sampling by
+// PrefetchCount steps of priority staleness.
+//
+// The worker owns its RandomEngine (a separate seed of the singleton) since
+// the acting thread keeps using the trainer's engine; the engine passed to
+// sample() is unused.
+template <typename ReplayBuf, typename BatchType, typename RandomEngine,
+          std::size_t PrefetchCount>
+class PrefetchSampler {
+  static_assert(PrefetchCount > 0, "PrefetchCount must be positive");
+
+  struct Slot {
+    Slot(const unsigned _batch_size)
+        : m_batch(_batch_size), m_choices(_batch_size) {}
+    BatchType m_batch;
+    Eigen::ArrayXi m_choices;
+  };
+
+  struct PrioUpdate {
+    Eigen::ArrayXi m_choices;
+    torch::Tensor m_prios;
+  };
+
+public:
+  static constexpr bool is_persistent = ReplayBuf::is_persistent;
+  static constexpr bool is_thread_safe = true;
+
+  template <typename... Args>
+  PrefetchSampler(Args &&... args)
+      : m_replay(std::forward<Args>(args)...),
+        m_random_engine(RandomEngine::getInstance()), m_frame(0),
+        m_current(-1), m_active(false), m_stop(false) {
+    m_slots.reserve(PrefetchCount + 1);
+    for (std::size_t i = 0; i < PrefetchCount + 1; ++i) {
+      m_slots.emplace_back(m_replay.getBatchSize());
+      m_free.push_back(i);
+    }
+    m_worker = std::thread(&PrefetchSampler::run, this);
+  }
+
+  PrefetchSampler(const PrefetchSampler &) = delete;
+  PrefetchSampler &operator=(const PrefetchSampler &) = delete;
+
+  ~PrefetchSampler() {
+    {
+      std::lock_guard<std::mutex> lock(m_queue_mutex);
+      m_stop = true;
+    }
+    m_free_cv.notify_one();
+    m_worker.join();
+  }
+
+  inline bool isCapacityReached() const {
+    std::lock_guard<std::mutex> lock(m_replay_mutex);
+    return m_replay.isCapacityReached();
+  }
+
+  inline unsigned getBatchSize() const { return m_replay.getBatchSize(); }
+
+  template <typename AnyRandomEngine>
+  const BatchType &sample(AnyRandomEngine &, const unsigned _frame) {
+    m_frame.store(_frame, std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(m_queue_mutex);
+    if (!m_active) {
+      // only start drawing once the learner asks, the buffer may be empty
+      // before then
+      m_active = true;
+      m_free_cv.notify_one();
+    }
+    m_ready_cv.wait(lock, [this] { return !m_ready.empty(); });
+    m_current = m_ready.front();
+    m_ready.pop_front();
+    return m_slots[m_current].m_batch;
+  }
+
+  void updatePrios(const torch::Tensor &_prios) {
+    PrioUpdate update{m_slots[m_current].m_choices, _prios.detach().cpu()};
+    {
+      std::lock_guard<std::mutex> lock(m_queue_mutex);
+      m_pending_updates.push_back(std::move(update));
+      m_free.push_back(m_current);
+      m_current = -1;
+    }
+    m_free_cv.notify_one();
+  }
+
+  void push(const BatchType &_batch, const std::size_t _obj_count) {
+    std::lock_guard<std::mutex> lock(m_replay_mutex);
+    m_replay.push(_batch, _obj_count);
+  }
+
+  void save(torch::serialize::OutputArchive &archive_) const {
+    std::lock_guard<std::mutex> lock(m_replay_mutex);
+    m_replay.save(archive_);
+    archive_.write("sampler_rng", c10::IValue(m_random_engine.getState()));
+  }
+
+  // batches already prefetched were drawn from the old contents
+  void load(torch::serialize::InputArchive &archive_) {
+    std::lock_guard<std::mutex> lock(m_replay_mutex);
+    m_replay.load(archive_);
+    c10::IValue sampler_rng;
+    archive_.read("sampler_rng", sampler_rng);
+    m_random_engine.setState(sampler_rng.toStringRef());
+  }
+
+private:
+  void run() {
+    std::vector<PrioUpdate> updates;
+    while (true) {
+      std::size_t slot;
+      {
+        std::unique_lock<std::mutex> lock(m_queue_mutex);
+        m_free_cv.wait(lock, [this] {
+          return m_stop || (m_active && !m_free.empty());
+        });
+        if (m_stop) {
+          return;
+        }
+        slot = m_free.front();
+        m_free.pop_front();
+        updates.swap(m_pending_updates);
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(m_replay_mutex);
+        for (const auto &update : updates) {
+          m_replay.updatePrios(update.m_prios, update.m_choices);
+        }
+        m_replay.sampleInto(m_random_engine,
+                            m_frame.load(std::memory_order_relaxed),
+                            m_slots[slot].m_batch, m_slots[slot].m_choices);
+      }
+      updates.clear();
+
+      {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        m_ready.push_back(slot);
+      }
+      m_ready_cv.notify_one();
+    }
+  }
+
+private:
+  ReplayBuf m_replay;
+  RandomEngine &m_random_engine;
+  std::atomic<unsigned> m_frame;
+
+  std::vector<Slot> m_slots;
+  std::deque<std::size_t> m_free;
+  std::deque<std::size_t> m_ready;
+  std::vector<PrioUpdate> m_pending_updates;
+  int m_current;
+  bool m_active;
+  bool m_stop;
+
+  mutable std::mutex m_replay_mutex;
+  std::mutex m_queue_mutex;
+  std::condition_variable m_free_cv;
+  std::condition_variable m_ready_cv;
+  std::thread m_worker;
+};
+
+#endif /* PREFETCH_SAMPLER_HPP_ */
@@ -0,0 +1,103 @@
+#ifndef QUANTIZED_DQN_HPP_
+#define QUANTIZED_DQN_HPP_
+
+#include "dqn.hpp"
+#include <ATen/ATen.h>
+#include <torch/torch.h>
+
+// Dynamically quantized linear layer (fbgemm): int8 weights quantized once
+// per tensor, activations quantized per call, fp32 in and out. CPU only.
+class QuantizedLinear {
+public:
+  QuantizedLinear() = default;
+
+  QuantizedLinear(const torch::Tensor &_weight, const torch::Tensor &_bias) {
+    quantize(_weight, _bias);
+  }
+
+  void quantize(const torch::Tensor &_weight, const torch::Tensor &_bias) {
+    torch::NoGradGuard no_grad;
+    auto weight = _weight.detach().to(torch::kCPU).contiguous();
+    auto quantized = at::fbgemm_linear_quantize_weight(weight);
+    m_weight = std::get<0>(quantized);
+    m_col_offsets = std::get<1>(quantized);
+    m_scale = std::get<2>(quantized);
+    m_zero_point = std::get<3>(quantized);
+    m_packed = at::fbgemm_pack_quantized_matrix(m_weight);
+    m_bias = _bias.detach().to(torch::kCPU).contiguous();
+  }
+
+  inline torch::Tensor forward(const torch::Tensor &x) const {
+    return at::fbgemm_linear_int8_weight_fp32_activation(
+        x, m_weight, m_packed, m_col_offsets, m_scale, m_zero_point, m_bias);
+  }
+
+private:
+  torch::Tensor m_weight;
+  torch::Tensor m_packed;
+  torch::Tensor m_col_offsets;
+  double m_scale = 1.;
+  int64_t m_zero_point = 0;
+  torch::Tensor m_bias;
+};
+
+// Inference only BigDQN for CPU deployment. The four head linears, which
+// hold nearly all of the FLOPs (featureSize() x 512 twice), run as int8
+// with fbgemm; NoisyLinear heads are quantized from their mu weights, i.e.
+// the eval forward. The small conv trunk stays fp32 and is shared with the
+// float model, which must outlive this and runs the trunk in its own mode
+// (eval for deployment); call requantize after weight updates.
+class QuantizedBigDQN {
+public:
+  explicit QuantizedBigDQN(BigDQN &model_) : m_model(model_) { requantize(); }
+
+  // leaves the float model in the mode it was in
+  void requantize() {
+    torch::NoGradGuard no_grad;
+    const bool was_training = m_model.is_training();
+    m_model.eval();
+    m_linear1_v.quantize(m_model.m_linear1_v->weight, m_model.m_linear1_v->bias);
+    m_linear2_v.quantize(m_model.m_linear2_v->weight, m_model.m_linear2_v->bias);
+    m_linear1_a.quantize(m_model.m_linear1_a->m_weight_mu,
+                         m_model.m_linear1_a->m_bias_mu);
+    m_linear2_a.quantize(m_model.m_linear2_a->m_weight_mu,
+                         m_model.m_linear2_a->m_bias_mu);
+    m_model.train(was_training);
+  }
+
+  inline torch::Tensor forward(torch::Tensor geometric) {
+    torch::NoGradGuard no_grad;
+    auto input = m_model.features(geometric).contiguous();
+    auto advantage = torch::elu(m_linear1_a.forward(input));
+    advantage = m_linear2_a.forward(advantage);
+
+    auto value = torch::elu(m_linear1_v.forward(input));
+    value = m_linear2_v.forward(value);
+
+    return m_model.dueling(value, advantage);
+  }
+
+private:
+  BigDQN &m_model;
+  QuantizedLinear m_linear1_v, m_linear2_v;
+  QuantizedLinear m_linear1_a, m_linear2_a;
+};
+
+// fraction of rows where both models pick the same greedy action
+template <typename FloatModel, typename QuantizedModel>
+static float greedy_agreement(FloatModel &float_model_,
+                              QuantizedModel &quantized_model_,
+                              const torch::Tensor &_observations,
+                              const torch::Tensor &_support) {
+  torch::NoGradGuard no_grad;
+  const auto float_actions =
+      (float_model_.forward(_observations) * _support).sum(2).argmax(1);
+  const auto quantized_actions =
+      (quantized_model_.forward(_observations) * _support).sum(2).argmax(1);
+  return float_actions.eq(quantized_actions)
+      .to(torch::kFloat32)
+      .mean()
+      .template item<float>();
+}
+
+#endif /* QUANTIZED_DQN_HPP_ */
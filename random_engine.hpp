@@ -12,6 +12,8 @@
 #include <chrono>
 #include <cstdint>
 #include <random>
+#include <sstream>
+#include <string>
 #include <type_traits>
 
 template <typename T, uint64_t SpecifiedSeed = 0> class RandomEngine {
@@ -31,6 +33,18 @@ public:
 
   inline std::mt19937 &getGenerator() { return m_rng; }
 
+  // textual mt19937 state, for checkpoints
+  inline std::string getState() const {
+    std::ostringstream os;
+    os << m_rng;
+    return os.str();
+  }
+
+  inline void setState(const std::string &_state) {
+    std::istringstream is(_state);
+    is >> m_rng;
+  }
+
 private:
   RandomEngine(uint64_t seed)
       : m_seed(seed == 0 ? std::chrono::high_resolution_clock::now()
@@ -14,12 +14,16 @@
 #include "model_config.hpp"
 #include "template_util.hpp"
 #include <Eigen/Dense>
+#include <cstring>
 #include <torch/torch.h>
 
 template <torch::DeviceType DeviceType, typename BatchType,
           typename ExampleType>
 class ReplayBuffer {
 public:
+  static constexpr bool is_persistent = false;
+  static constexpr bool is_thread_safe = false;
+
   ReplayBuffer(const unsigned _capacity, const unsigned _batch_size,
                const float _alpha, const float _beta, const float _beta_decay)
       : m_is_capacity_reached(false), m_capacity(_capacity),
@@ -32,20 +36,32 @@ public:
                                             .requires_grad(false)
                                             .device(torch::kCPU))) {}
 
+  inline bool isCapacityReached() const { return m_is_capacity_reached; }
+
+  inline unsigned getBatchSize() const { return m_batch_size; }
+
   template <typename RandomEngine>
   const BatchType &sample(RandomEngine &random_engine_, const unsigned _frame) {
+    sampleInto(random_engine_, _frame, m_batch, m_choices);
+    return m_batch;
+  }
+
+  // samples into caller owned storage so several batches can be in flight
+  template <typename RandomEngine>
+  void sampleInto(RandomEngine &random_engine_, const unsigned _frame,
+                  BatchType &batch_, Eigen::Ref<Eigen::ArrayXi> choices_) {
     const float max_prio = m_pos > 0 ? m_prios.maxCoeff() : 1;
     const auto prios = m_is_capacity_reached ? m_prios : m_prios.head(m_pos);
     Eigen::ArrayXf probs = prios.pow(m_alpha);
     probs /= probs.sum();
-    choice(random_engine_, probs, m_cumsum.head(probs.size()), m_choices);
+    choice(random_engine_, probs, m_cumsum.head(probs.size()), choices_);
 
     std::cout << "REPLAY prios: " << std::endl;
     std::cout << prios.maxCoeff() << ", " << prios.minCoeff() << std::endl;
 
     for (int i = 0; i < m_batch_size; ++i) {
-      auto const &sample = m_buffer[m_choices(i)];
-      m_batch.set(i, sample);
+      auto const &sample = m_buffer[choices_(i)];
+      batch_.set(i, sample);
     }
 
     const auto weights =
@@ -53,21 +69,24 @@ public:
             .pow(-std::min(1.f, m_beta + _frame * (1 - m_beta) / m_beta_decay));
     auto weights_on_cpu_a = m_weights_on_cpu.accessor<float, 1>();
     for (int i = 0; i < m_batch_size; ++i) {
-      weights_on_cpu_a[i] = weights(m_choices(i));
+      weights_on_cpu_a[i] = weights(choices_(i));
     }
-    m_batch.m_weights.index_put_(
+    batch_.m_weights.index_put_(
         {torch::indexing::Slice(0, m_batch_size, 1)},
         m_weights_on_cpu.index({torch::indexing::Slice(0, m_batch_size, 1)})
             .to(DeviceType, false, false));
-
-    return m_batch;
   }
 
   void updatePrios(const torch::Tensor &_prios) {
+    updatePrios(_prios, m_choices);
+  }
+
+  void updatePrios(const torch::Tensor &_prios,
+                   const Eigen::Ref<const Eigen::ArrayXi> &_choices) {
     auto prios_cpu = _prios.cpu().squeeze();
     auto a = prios_cpu.accessor<float, 1>();
     for (int i = 0; i < m_batch_size; ++i) {
-      m_prios(m_choices(i)) = a[i];
+      m_prios(_choices(i)) = a[i];
     }
   }
 
@@ -88,23 +107,7 @@ public:
     const float max_prio = m_pos > 0 ? m_prios.maxCoeff() : 1;
     for (int i = 0; i < _obj_count; ++i) {
 
-      auto &example = m_buffer[m_pos];
-      example.m_state.m_geometric.index_put_(
-          {torch::indexing::None}, _batch.m_state.m_geometric.index({i}));
-
-      example.m_state.m_temporal.index_put_(
-          {torch::indexing::None}, _batch.m_state.m_temporal.index({i}));
-
-      example.m_action = _batch.m_action.index({i}).item().template to<int>();
-      example.m_reward = _batch.m_reward.index({i}).item().template to<float>();
-      example.m_is_non_terminal =
-          _batch.m_is_non_terminal.index({i}).item().template to<bool>();
-
-      example.m_next_state.m_geometric.index_put_(
-          {torch::indexing::None}, _batch.m_next_state.m_geometric.index({i}));
-
-      example.m_next_state.m_temporal.index_put_(
-          {torch::indexing::None}, _batch.m_next_state.m_temporal.index({i}));
+      _batch.get(i, m_buffer[m_pos]);
 
       m_prios(m_pos) = max_prio;
       m_pos = (m_pos + 1) % m_capacity;
@@ -116,6 +119,29 @@ public:
     }
   }
 
+  void save(torch::serialize::OutputArchive &archive_) const {
+    save_transitions(archive_, m_buffer,
+                     m_is_capacity_reached ? m_capacity : m_pos);
+    archive_.write("prios",
+                   torch::from_blob(const_cast<float *>(m_prios.data()),
+                                    {static_cast<int64_t>(m_capacity)})
+                       .clone());
+    archive_.write("pos", torch::tensor(static_cast<int64_t>(m_pos)));
+    archive_.write("is_capacity_reached", torch::tensor(m_is_capacity_reached));
+  }
+
+  void load(torch::serialize::InputArchive &archive_) {
+    load_transitions(archive_, m_buffer);
+    torch::Tensor prios, pos, is_capacity_reached;
+    archive_.read("prios", prios);
+    archive_.read("pos", pos);
+    archive_.read("is_capacity_reached", is_capacity_reached);
+    std::memcpy(m_prios.data(), prios.data_ptr<float>(),
+                sizeof(float) * std::min<int64_t>(prios.numel(), m_capacity));
+    m_pos = pos.item<int64_t>() % m_capacity;
+    m_is_capacity_reached = is_capacity_reached.item<bool>();
+  }
+
 private:
   bool m_is_capacity_reached;
   unsigned m_capacity;
@@ -132,4 +158,14 @@ private:
   torch::Tensor m_weights_on_cpu;
 };
 
+// learning starts after the warmup frames, or right away on a restored
+// persistent buffer that is already full
+template <typename ReplayBuf>
+static inline bool is_replay_warm(const ReplayBuf &_replay_buffer,
+                                  const std::size_t _frame,
+                                  const std::size_t _warmup_frames) {
+  return _frame > _warmup_frames ||
+         (ReplayBuf::is_persistent && _replay_buffer.isCapacityReached());
+}
+
 #endif /* REPLAY_BUFFER_HPP_ */
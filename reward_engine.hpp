@@ -59,7 +59,7 @@ class CityTileRewardEngine {
 };
 
 
-template <torch::DeviceType DeviceType>
+template <torch::DeviceType DeviceType, typename BoardConfig>
 class WorkerRewardEngine {
 public:
   WorkerRewardEngine()
@@ -5,5 +5,13 @@ constexpr char ack_actions_forwarded = '%';
 constexpr char ack_inputs_processed = '?';
 constexpr char game_start_key = '*';
 constexpr key_t key = 5678;
+constexpr key_t weights_key = 5679;
+// shared weights of the trainers for the other map sizes, offset by size
+constexpr key_t sized_weights_key_base = 5700;
+// environment connection of each actor, actor 0 keeps the original key
+constexpr key_t actor_key_base = 5680;
+constexpr key_t actor_slot_key(const std::size_t _actor) {
+	return _actor == 0 ? key : actor_key_base + static_cast<key_t>(_actor) - 1;
+}
 
 
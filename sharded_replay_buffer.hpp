@@ -0,0 +1,238 @@
+#ifndef SHARDED_REPLAY_BUFFER_HPP_
+#define SHARDED_REPLAY_BUFFER_HPP_
+
+#include "sum_tree.hpp"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <torch/torch.h>
+#include <vector>
+
+// Prioritized replay split into ShardCount independently locked shards, each
+// with its own sum tree. Any number of actor threads can push concurrently:
+// a writer starts at its thread's home shard and moves to the next free one
+// instead of blocking. A single learner samples across shards proportionally
+// to their total priority.
+//
+// Choices handed out by sampleInto are global slots (shard * shard capacity
+// + index) so updatePrios can route back without extra state.
+template <torch::DeviceType DeviceType, typename BatchType,
+          typename ExampleType, std::size_t ShardCount>
+class ShardedReplayBuffer {
+  static_assert(ShardCount > 0, "ShardCount must be positive");
+
+  struct Shard {
+    Shard(const unsigned _capacity)
+        : m_tree(_capacity), m_buffer(_capacity), m_pos(0), m_size(0),
+          m_max_prio(1) {}
+    std::mutex m_mutex;
+    SumTree m_tree;
+    std::vector<ExampleType> m_buffer;
+    unsigned m_pos;
+    std::atomic<unsigned> m_size;
+    float m_max_prio;
+  };
+
+public:
+  static constexpr bool is_persistent = false;
+  static constexpr bool is_thread_safe = true;
+
+  ShardedReplayBuffer(const unsigned _capacity, const unsigned _batch_size,
+                      const float _alpha, const float _beta,
+                      const float _beta_decay)
+      : m_shard_capacity((_capacity + ShardCount - 1) / ShardCount),
+        m_batch_size(_batch_size), m_alpha(_alpha), m_beta(_beta),
+        m_beta_decay(_beta_decay), m_choices(_batch_size), m_batch(_batch_size),
+        m_draws(_batch_size), m_shard_totals(ShardCount), m_next_home(0),
+        m_weights_on_cpu(
+            torch::zeros({_batch_size}, torch::dtype(torch::kFloat32)
+                                            .requires_grad(false)
+                                            .device(torch::kCPU))) {
+    m_shards.reserve(ShardCount);
+    for (std::size_t i = 0; i < ShardCount; ++i) {
+      m_shards.emplace_back(new Shard(m_shard_capacity));
+    }
+  }
+
+  inline unsigned getBatchSize() const { return m_batch_size; }
+
+  inline std::size_t size() const {
+    std::size_t total = 0;
+    for (const auto &shard : m_shards) {
+      total += shard->m_size.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  inline bool isCapacityReached() const {
+    return size() == m_shard_capacity * ShardCount;
+  }
+
+  void push(const BatchType &_batch, const std::size_t _obj_count) {
+    Shard &shard = lockShard();
+    std::lock_guard<std::mutex> lock(shard.m_mutex, std::adopt_lock);
+    const float prio = std::pow(shard.m_max_prio, m_alpha);
+    for (std::size_t i = 0; i < _obj_count; ++i) {
+      _batch.get(i, shard.m_buffer[shard.m_pos]);
+      shard.m_tree.set(shard.m_pos, prio);
+      shard.m_pos = (shard.m_pos + 1) % m_shard_capacity;
+    }
+    shard.m_size.store(std::min<unsigned>(shard.m_size + _obj_count,
+                                          m_shard_capacity),
+                       std::memory_order_relaxed);
+  }
+
+  template <typename RandomEngine>
+  const BatchType &sample(RandomEngine &random_engine_, const unsigned _frame) {
+    sampleInto(random_engine_, _frame, m_batch, m_choices);
+    return m_batch;
+  }
+
+  template <typename RandomEngine>
+  void sampleInto(RandomEngine &random_engine_, const unsigned _frame,
+                  BatchType &batch_, Eigen::Ref<Eigen::ArrayXi> choices_) {
+    float total = 0;
+    std::size_t last_shard = 0;
+    for (std::size_t s = 0; s < ShardCount; ++s) {
+      std::lock_guard<std::mutex> lock(m_shards[s]->m_mutex);
+      m_shard_totals(s) = m_shards[s]->m_tree.total();
+      total += m_shard_totals(s);
+      if (m_shard_totals(s) > 0) {
+        last_shard = s;
+      }
+    }
+
+    // stratified draws, sorted by construction, so each shard is visited
+    // and locked once
+    for (unsigned i = 0; i < m_batch_size; ++i) {
+      m_draws(i) = (i + random_engine_.uniform()) * total / m_batch_size;
+    }
+
+    const float beta =
+        std::min(1.f, m_beta + _frame * (1 - m_beta) / m_beta_decay);
+    const float stored = static_cast<float>(size());
+    auto weights_a = m_weights_on_cpu.accessor<float, 1>();
+    unsigned i = 0;
+    float shard_offset = 0;
+    for (std::size_t s = 0; s <= last_shard && i < m_batch_size; ++s) {
+      const float shard_end = shard_offset + m_shard_totals(s);
+      if (m_draws(i) >= shard_end && s < last_shard) {
+        shard_offset = shard_end;
+        continue;
+      }
+      Shard &shard = *m_shards[s];
+      std::lock_guard<std::mutex> lock(shard.m_mutex);
+      // writers may have moved the shard total since it was read
+      const float shard_total = shard.m_tree.total();
+      // leaves past the stored transitions are empty slots
+      const unsigned last_index =
+          std::max(shard.m_size.load(std::memory_order_relaxed), 1u) - 1;
+      for (; i < m_batch_size && (m_draws(i) < shard_end || s == last_shard);
+           ++i) {
+        const float mass =
+            std::min(m_draws(i) - shard_offset, std::nextafter(shard_total, 0.f));
+        const unsigned index =
+            std::min(shard.m_tree.find(std::max(mass, 0.f)), last_index);
+        batch_.set(i, shard.m_buffer[index]);
+        choices_(i) = static_cast<int>(s * m_shard_capacity + index);
+        const float prob = shard.m_tree.get(index) / total;
+        weights_a[i] = std::pow(stored * prob, -beta);
+      }
+      shard_offset = shard_end;
+    }
+
+    batch_.m_weights.index_put_(
+        {torch::indexing::Slice(0, m_batch_size, 1)},
+        m_weights_on_cpu.to(DeviceType, false, false));
+  }
+
+  void updatePrios(const torch::Tensor &_prios) {
+    updatePrios(_prios, m_choices);
+  }
+
+  void updatePrios(const torch::Tensor &_prios,
+                   const Eigen::Ref<const Eigen::ArrayXi> &_choices) {
+    auto prios_cpu = _prios.cpu().squeeze();
+    auto a = prios_cpu.accessor<float, 1>();
+    for (unsigned i = 0; i < m_batch_size; ++i) {
+      Shard &shard = *m_shards[_choices(i) / m_shard_capacity];
+      std::lock_guard<std::mutex> lock(shard.m_mutex);
+      shard.m_tree.set(_choices(i) % m_shard_capacity, std::pow(a[i], m_alpha));
+      shard.m_max_prio = std::max(shard.m_max_prio, a[i]);
+    }
+  }
+
+  void save(torch::serialize::OutputArchive &archive_) const {
+    for (std::size_t s = 0; s < ShardCount; ++s) {
+      Shard &shard = *m_shards[s];
+      std::lock_guard<std::mutex> lock(shard.m_mutex);
+      const unsigned size = shard.m_size.load(std::memory_order_relaxed);
+      torch::serialize::OutputArchive shard_archive;
+      save_transitions(shard_archive, shard.m_buffer, size);
+      auto leaves = torch::empty({static_cast<int64_t>(size)});
+      for (unsigned i = 0; i < size; ++i) {
+        leaves[i] = shard.m_tree.get(i);
+      }
+      shard_archive.write("leaves", leaves);
+      shard_archive.write("pos", torch::tensor(static_cast<int64_t>(shard.m_pos)));
+      shard_archive.write("max_prio", torch::tensor(shard.m_max_prio));
+      archive_.write("shard_" + std::to_string(s), shard_archive);
+    }
+  }
+
+  void load(torch::serialize::InputArchive &archive_) {
+    for (std::size_t s = 0; s < ShardCount; ++s) {
+      Shard &shard = *m_shards[s];
+      std::lock_guard<std::mutex> lock(shard.m_mutex);
+      torch::serialize::InputArchive shard_archive;
+      archive_.read("shard_" + std::to_string(s), shard_archive);
+      const std::size_t size = load_transitions(shard_archive, shard.m_buffer);
+      torch::Tensor leaves, pos, max_prio;
+      shard_archive.read("leaves", leaves);
+      shard_archive.read("pos", pos);
+      shard_archive.read("max_prio", max_prio);
+      for (unsigned i = 0; i < size; ++i) {
+        shard.m_tree.set(i, leaves[i].item<float>());
+      }
+      shard.m_pos = pos.item<int64_t>() % m_shard_capacity;
+      shard.m_max_prio = max_prio.item<float>();
+      shard.m_size.store(size, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  // returns a locked shard, preferring one no other writer holds
+  inline Shard &lockShard() {
+    thread_local const std::size_t home =
+        m_next_home.fetch_add(1, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < ShardCount; ++i) {
+      Shard &shard = *m_shards[(home + i) % ShardCount];
+      if (shard.m_mutex.try_lock()) {
+        return shard;
+      }
+    }
+    Shard &shard = *m_shards[home % ShardCount];
+    shard.m_mutex.lock();
+    return shard;
+  }
+
+private:
+  unsigned m_shard_capacity;
+  unsigned m_batch_size;
+  float m_alpha;
+  float m_beta;
+  float m_beta_decay;
+  Eigen::ArrayXi m_choices;
+  BatchType m_batch;
+  Eigen::ArrayXf m_draws;
+  Eigen::ArrayXf m_shard_totals;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  std::atomic<std::size_t> m_next_home;
+  torch::Tensor m_weights_on_cpu;
+};
+
+#endif /* SHARDED_REPLAY_BUFFER_HPP_ */
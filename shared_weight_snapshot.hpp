@@ -0,0 +1,187 @@
+#ifndef SHARED_WEIGHT_SNAPSHOT_HPP_
+#define SHARED_WEIGHT_SNAPSHOT_HPP_
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <torch/torch.h>
+#include <vector>
+#include "server.hpp"
+#include "weight_snapshot.hpp"
+
+struct SharedWeightHeader {
+  std::atomic<uint64_t> m_sequence; // odd while the learner is writing
+  std::atomic<uint64_t> m_version;
+  uint64_t m_bytes;
+  uint64_t m_layout; // layoutHash of the model, 0 on a fresh segment
+};
+
+// Same interface as WeightSnapshot, but the weights live in a SysV shared
+// memory segment guarded by a seqlock, so actors in other threads or
+// processes can attach by key. Publishing never blocks readers and readers
+// never take a lock: acquire copies straight into the model's tensors and
+// retries if the sequence moved underneath it.
+class SharedWeightSnapshot {
+public:
+  template <typename Model>
+  SharedWeightSnapshot(const Model &_like, const key_t _key = weights_key)
+      : m_bytes(0), m_layout(layoutHash(_like)) {
+    for (const auto &tensor : WeightSnapshot::modelTensors(_like)) {
+      m_offsets.push_back(m_bytes);
+      m_bytes += (tensor.nbytes() + 63) & ~static_cast<std::size_t>(63);
+    }
+    attach(_key, sizeof(SharedWeightHeader) + 64 + m_bytes);
+  }
+
+  SharedWeightSnapshot(const SharedWeightSnapshot &) = delete;
+  SharedWeightSnapshot &operator=(const SharedWeightSnapshot &) = delete;
+
+  ~SharedWeightSnapshot() {
+    if (m_header != nullptr) {
+      shmdt(m_header);
+    }
+  }
+
+  inline uint64_t getVersion() const {
+    return m_header->m_version.load(std::memory_order_acquire);
+  }
+
+  // single writer
+  template <typename Model> void publish(const Model &_model) {
+    torch::NoGradGuard no_grad;
+    const auto tensors = WeightSnapshot::modelTensors(_model);
+    const uint64_t sequence =
+        m_header->m_sequence.load(std::memory_order_relaxed);
+    m_header->m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < tensors.size(); ++i) {
+      region(i, tensors[i]).copy_(tensors[i]);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->m_sequence.store(sequence + 2, std::memory_order_release);
+    m_header->m_version.fetch_add(1, std::memory_order_release);
+  }
+
+  template <typename Model> bool acquire(Model &model_, uint64_t &version_) {
+    const uint64_t version = getVersion();
+    if (version == version_) {
+      return false;
+    }
+    torch::NoGradGuard no_grad;
+    auto tensors = WeightSnapshot::modelTensors(model_);
+    while (true) {
+      const uint64_t before =
+          m_header->m_sequence.load(std::memory_order_acquire);
+      if (before & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      for (std::size_t i = 0; i < tensors.size(); ++i) {
+        tensors[i].copy_(region(i, tensors[i]));
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_header->m_sequence.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+    version_ = version;
+    return true;
+  }
+
+  // FNV-1a over the names, dtypes, shapes and strides of the parameters and
+  // buffers: equal byte counts alone do not make two layouts compatible,
+  // e.g. BigDQN before and after toChannelsLast
+  template <typename Model> static uint64_t layoutHash(const Model &_model) {
+    uint64_t hash = 14695981039346656037ull;
+    const auto mix = [&hash](const void *_data, const std::size_t _bytes) {
+      const auto *bytes = static_cast<const unsigned char *>(_data);
+      for (std::size_t i = 0; i < _bytes; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+      }
+    };
+    const auto mix_tensor = [&mix](const std::string &_name,
+                                   const torch::Tensor &_tensor) {
+      mix(_name.data(), _name.size());
+      const auto type = static_cast<int>(_tensor.scalar_type());
+      mix(&type, sizeof(type));
+      mix(_tensor.sizes().data(), _tensor.sizes().size() * sizeof(int64_t));
+      mix(_tensor.strides().data(),
+          _tensor.strides().size() * sizeof(int64_t));
+    };
+    for (const auto &parameter : _model.named_parameters(true)) {
+      mix_tensor(parameter.key(), parameter.value());
+    }
+    for (const auto &buffer : _model.named_buffers(true)) {
+      mix_tensor(buffer.key(), buffer.value());
+    }
+    return hash == 0 ? 1 : hash;
+  }
+
+private:
+  // cpu view of the i'th tensor's slot, a copy_ into or out of it is a
+  // memcpy for cpu models and a single transfer otherwise
+  inline torch::Tensor region(const std::size_t _i,
+                              const torch::Tensor &_like) const {
+    return torch::from_blob(m_data + m_offsets[_i], _like.sizes(),
+                            torch::dtype(_like.scalar_type())
+                                .requires_grad(false)
+                                .device(torch::kCPU));
+  }
+
+  void attach(const key_t _key, const std::size_t _size) {
+    int shmid = shmget(_key, _size, IPC_CREAT | 0666);
+    if (shmid < 0 && errno == EINVAL) {
+      // stale segment from a different model, replace it
+      const int stale = shmget(_key, 0, 0666);
+      if (stale >= 0) {
+        shmctl(stale, IPC_RMID, nullptr);
+      }
+      shmid = shmget(_key, _size, IPC_CREAT | 0666);
+    }
+    map(shmid);
+    if (m_header->m_layout != 0 && m_header->m_layout != m_layout) {
+      // large enough but written by another model, replace it
+      shmdt(m_header);
+      shmctl(shmid, IPC_RMID, nullptr);
+      map(shmget(_key, _size, IPC_CREAT | 0666));
+    }
+    if (m_header->m_layout != m_layout) {
+      // fresh segment, zero filled by the kernel
+      m_header->m_sequence.store(0, std::memory_order_relaxed);
+      m_header->m_version.store(0, std::memory_order_relaxed);
+      m_header->m_bytes = m_bytes;
+      m_header->m_layout = m_layout;
+    }
+  }
+
+  void map(const int _shmid) {
+    if (_shmid < 0) {
+      perror("shmget");
+      exit(1);
+    }
+    void *mem = shmat(_shmid, nullptr, 0);
+    if (mem == (void *)-1) {
+      perror("shmat");
+      exit(1);
+    }
+    m_header = static_cast<SharedWeightHeader *>(mem);
+    m_data = static_cast<char *>(mem) +
+             ((sizeof(SharedWeightHeader) + 63) & ~static_cast<std::size_t>(63));
+  }
+
+private:
+  std::size_t m_bytes;
+  uint64_t m_layout;
+  std::vector<std::size_t> m_offsets;
+  SharedWeightHeader *m_header = nullptr;
+  char *m_data = nullptr;
+};
+
+#endif /* SHARED_WEIGHT_SNAPSHOT_HPP_ */
@@ -0,0 +1,62 @@
+#ifndef SUM_TREE_HPP_
+#define SUM_TREE_HPP_
+
+#include <Eigen/Dense>
+#include <algorithm>
+
+// Binary sum tree over a fixed number of leaves. Leaf updates and prefix sum
+// lookups are O(log n), replacing the O(capacity) cumsum per sample.
+class SumTree {
+public:
+  SumTree(const unsigned _capacity)
+      : m_capacity(_capacity), m_leaves(leafCount(_capacity)),
+        m_tree(Eigen::ArrayXf::Zero(2 * m_leaves)) {}
+
+  inline float total() const { return m_tree(1); }
+
+  inline float get(const unsigned _index) const {
+    return m_tree(m_leaves + _index);
+  }
+
+  // parents are recomputed from their children rather than shifted by a
+  // delta, so rounding never accumulates and empty subtrees stay at 0
+  inline void set(const unsigned _index, const float _value) {
+    unsigned node = m_leaves + _index;
+    m_tree(node) = _value;
+    for (node >>= 1; node > 0; node >>= 1) {
+      m_tree(node) = m_tree(node << 1) + m_tree((node << 1) + 1);
+    }
+  }
+
+  // index of the leaf whose prefix sum interval contains _mass. Never
+  // descends into an empty subtree, so a draw at the upper boundary still
+  // lands on a leaf with priority once total() > 0
+  inline unsigned find(float _mass) const {
+    unsigned node = 1;
+    while (node < m_leaves) {
+      const unsigned left = node << 1;
+      if (_mass < m_tree(left) || m_tree(left + 1) <= 0) {
+        node = left;
+      } else {
+        _mass -= m_tree(left);
+        node = left + 1;
+      }
+    }
+    return std::min(node - m_leaves, m_capacity - 1);
+  }
+
+private:
+  static inline unsigned leafCount(const unsigned _capacity) {
+    unsigned leaves = 1;
+    while (leaves < _capacity) {
+      leaves <<= 1;
+    }
+    return leaves;
+  }
+
+  unsigned m_capacity;
+  unsigned m_leaves;
+  Eigen::ArrayXf m_tree;
+};
+
+#endif /* SUM_TREE_HPP_ */
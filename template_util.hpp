@@ -8,6 +8,10 @@
 #ifndef TEMPLATE_UTIL_HPP_
 #define TEMPLATE_UTIL_HPP_
 
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 template <class T> using remove_cv_t = typename std::remove_cv<T>::type;
 
 template <class T>
@@ -97,6 +101,18 @@ template <class Functor, class Tuple, std::size_t I = 0, typename... FuncArgs>
   tuple_for_each_type<Functor, Tuple, I + 1>(std::forward(func_args)...);
 }
 
+// std::tuple<T<0>, ..., T<N - 1>>
+template <template <std::size_t> class T, typename Indices> struct indexed_tuple;
+
+template <template <std::size_t> class T, std::size_t... Is>
+struct indexed_tuple<T, std::index_sequence<Is...>> {
+  using type = std::tuple<T<Is>...>;
+};
+
+template <template <std::size_t> class T, std::size_t N>
+using indexed_tuple_t =
+    typename indexed_tuple<T, std::make_index_sequence<N>>::type;
+
 template <std::size_t I = 0, typename FuncT, typename... Tp>
 inline typename std::enable_if<I == sizeof...(Tp), void>::type
 tuple_for_each_obj(std::tuple<Tp...> &, FuncT) {}
@@ -20,6 +20,83 @@ struct TrainConfig {
   static constexpr unsigned chunk_size = 100;
   static constexpr unsigned game_iterations = 10000;
   static constexpr torch::DeviceType device = DEVICE;
+  // a trainer per map size in BoardSizes (board_config.hpp), dispatched on
+  // each game's width; off trains BoardConfig::size only. Every size adds a
+  // Trainer per worker x citytile model pair to main.cpp's build
+  static constexpr bool train_all_board_sizes = false;
+
+  // replay backed by memory mapped files, restored on restart
+  static constexpr bool persistent_replay = false;
+  static constexpr const char *worker_replay_path = "worker_replay.mmap";
+  static constexpr const char *citytile_replay_path = "citytile_replay.mmap";
+
+  // independently locked replay shards for concurrent actor pushes,
+  // 0 keeps the single unsynchronized ReplayBuffer
+  static constexpr std::size_t replay_shards = 0;
+
+  // batches sampled ahead of the learner on a worker thread, 0 samples inline
+  static constexpr std::size_t prefetch_batches = 0;
+  static constexpr uint64_t sampler_seed = train_seed + 1;
+
+  // learner on its own thread, acting on a published copy of the weights.
+  // requires a thread safe replay (replay_shards or prefetch_batches)
+  static constexpr bool async_learner = false;
+  static constexpr uint64_t learner_seed = train_seed + 2;
+  // actors past the first (BoardConfig::actor_count > 1) run on their own
+  // threads, each served by a forwarder on actor_slot_key(i), and draw from
+  // RandomEngine<float, actor_seed + i>. requires async_learner
+  static constexpr uint64_t actor_seed = train_seed + 16;
+  // every actor's worker forward goes through one batching server thread
+  // instead of a network per actor. requires async_learner, not with
+  // frozen_acting
+  static constexpr bool inference_server = false;
+  static constexpr int64_t inference_max_rows = 256;
+  static constexpr int64_t inference_max_latency_us = 200;
+  // batch size and queueing delay histograms every n batches, 0 never
+  static constexpr std::size_t inference_stats_interval = 1000;
+  // publish learner weights through seqlock'd shared memory instead of a
+  // mutex guarded in-process snapshot
+  static constexpr bool shared_weights = false;
+  // one dynamic network forward over state and next_state stacked
+  static constexpr bool stacked_learner_forward = false;
+  // one BoardDQN forward over the global board per turn, each worker reading
+  // its own cell, instead of BigDQN over per worker egocentric boards
+  static constexpr bool board_policy = false;
+  // architectures by registry name (model_registry.hpp), overridden at
+  // startup by worker_model / citytile_model lines in model_config_path
+  static constexpr const char *worker_model =
+      board_policy ? "BoardDQN" : "BigDQN";
+  static constexpr const char *citytile_model = "SmallDQN";
+  static constexpr const char *model_config_path = "models.cfg";
+  // BigDQN conv trunk in channels_last on the oneDNN enabled CPU backend,
+  // for the learner and acting networks alike. Checkpoints do not carry
+  // over between layouts
+  static constexpr bool channels_last = false;
+  // act through a frozen TorchScript export of the worker network,
+  // re-exported whenever new weights reach the acting side
+  static constexpr bool frozen_acting = false;
+  // frozen TorchScript worker network loaded by agent_infer
+  static constexpr const char *worker_checkpoint_path = "worker_dqn.pt";
+  // agent_infer plays a BigDQN worker network with int8 head linears
+  // (QuantizedBigDQN), built from the eager weights that checkpoint() also
+  // writes to worker_weights_path. CPU only
+  static constexpr bool quantized_inference = false;
+  static constexpr const char *worker_weights_path = "worker_weights.pt";
+  // full training checkpoint every checkpoint_interval games, written on a
+  // background thread; 0 disables. resume_from_checkpoint restores it at
+  // startup
+  static constexpr unsigned checkpoint_interval = 0;
+  static constexpr const char *checkpoint_path = "trainer_checkpoint.pt";
+  static constexpr bool resume_from_checkpoint = false;
+  // per turn wall clock as the engine enforces it: turn_limit_ms every turn
+  // plus a bank of turn_overage_ms per game for overruns, which are always
+  // logged. turn_deadline also skips learner steps, and in agent_infer swaps
+  // the model for HeuristicPolicy, once a stage's running cost no longer
+  // fits in what is left of the turn less turn_safety_ms
+  static constexpr bool turn_deadline = false;
+  static constexpr double turn_limit_ms = 3000;
+  static constexpr double turn_overage_ms = 60000;
+  static constexpr double turn_safety_ms = 250;
 };
 
 #endif /* TRAIN_CONFIG_HPP_ */
@@ -8,23 +8,46 @@
 #ifndef TRAINER_HPP_
 #define TRAINER_HPP_
 
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <thread>
 #include <tuple>
+#include <unistd.h>
+#include <vector>
 #include "actions.hpp"
+#include "agent_io.hpp"
 #include "template_util.hpp"
 #include "hyper_parameters.hpp"
 #include "actor.hpp"
+#include "async_learner.hpp"
 #include "board_config.hpp"
+#include "checkpoint.hpp"
 #include "dqn.hpp"
 #include "feature_builder.hpp"
+#include "frozen_module.hpp"
+#include "inference_server.hpp"
 #include "math_util.hpp"
+#include "mmap_replay_buffer.hpp"
 #include "model_config.hpp"
 #include "model_learner.hpp"
+#include "prefetch_sampler.hpp"
 #include "random_engine.hpp"
 #include "replay_buffer.hpp"
 #include "reward_engine.hpp"
+#include "shared_weight_snapshot.hpp"
+#include "sharded_replay_buffer.hpp"
+#include "train_config.hpp"
+#include "turn_scheduler.hpp"
+#include "weight_snapshot.hpp"
 
+// One map size per instantiation; BoardConfig other than the default gives
+// every file, shm key and RNG stream of the trainer its own per size name,
+// so trainers for several sizes can live side by side.
 template <std::size_t ActorCount,
-          torch::DeviceType DeviceType, typename RandomEngine>
+          torch::DeviceType DeviceType, typename RandomEngine,
+          typename WorkerModel, typename CityTileModel, typename BoardConfig>
 class Trainer {
 public:
   using WorkerBatch = DynamicBatch<DeviceType, BoardConfig::size, WorkerModelConfig>;
@@ -33,9 +56,25 @@ public:
   using WorkerTransition = Transition<DeviceType, BoardConfig::size, WorkerModelConfig>;
   using CityTileTransition =
       Transition<DeviceType, BoardConfig::size, CityTileModelConfig>;
-  using WorkerReplayBuffer = ReplayBuffer<DeviceType, WorkerBatch, WorkerTransition>;
-  using CityTileReplayBuffer =
-      ReplayBuffer<DeviceType, CityTileBatch, CityTileTransition>;
+  using WorkerSampleBuffer = std::conditional_t<
+      TrainConfig::persistent_replay,
+      MMapReplayBuffer<DeviceType, WorkerBatch, WorkerTransition>,
+      std::conditional_t<(TrainConfig::replay_shards > 0),
+                         ShardedReplayBuffer<DeviceType, WorkerBatch,
+                                             WorkerTransition,
+                                             TrainConfig::replay_shards>,
+                         ReplayBuffer<DeviceType, WorkerBatch, WorkerTransition>>>;
+  using WorkerReplayBuffer = std::conditional_t<
+      (TrainConfig::prefetch_batches > 0),
+      PrefetchSampler<WorkerSampleBuffer, WorkerBatch,
+                      ::RandomEngine<float, TrainConfig::sampler_seed +
+                                              BoardConfig::seed_offset>,
+                      TrainConfig::prefetch_batches>,
+      WorkerSampleBuffer>;
+  using CityTileReplayBuffer = std::conditional_t<
+      TrainConfig::persistent_replay,
+      MMapReplayBuffer<DeviceType, CityTileBatch, CityTileTransition>,
+      ReplayBuffer<DeviceType, CityTileBatch, CityTileTransition>>;
 //  using WorkerRewardEngine = WorkerRewardEngine<DeviceType>;
 //  using CityTileRewardEngine = WorkerRewardEngine<DeviceType>;
 
@@ -44,18 +83,56 @@ public:
 		const Eigen::Ref<const Eigen::ArrayXi>>;
 
 
-	using WorkerDQN = BigDQN;
-	using CityTileDQN = SmallDQN;
+	using WorkerDQN = WorkerModel;
+	using WorkerFeatures = std::conditional_t<is_board_model<WorkerDQN>::value,
+		BoardFeatureBuilder, WorkerFeatureBuilder>;
+	using CityTileDQN = CityTileModel;
+
+  using WorkerModelLearner =
+      ModelLearner<WorkerDQN, DeviceType,
+                   static_cast<std::size_t>(WorkerActions::Count),
+                   TrainConfig::stacked_learner_forward>;
+  using CityTileModelLearner =
+      ModelLearner<CityTileDQN, DeviceType,
+                   static_cast<std::size_t>(CityTileActions::Count),
+                   TrainConfig::stacked_learner_forward>;
+  using WorkerFrozenDQN = FrozenModule<WorkerDQN, DeviceType>;
+  using WorkerSnapshot = std::conditional_t<TrainConfig::shared_weights,
+                                            SharedWeightSnapshot, WeightSnapshot>;
+  using LearnerRandomEngine =
+      ::RandomEngine<float, TrainConfig::learner_seed + BoardConfig::seed_offset>;
+  using WorkerAsyncLearner =
+      AsyncLearner<WorkerModelLearner, WorkerDQN, WorkerReplayBuffer,
+                   WorkerSnapshot,
+                   LearnerRandomEngine>;
+  static_assert(!TrainConfig::async_learner ||
+                    WorkerReplayBuffer::is_thread_safe,
+                "async learner requires a thread safe replay buffer");
+  static_assert(!TrainConfig::inference_server ||
+                    (TrainConfig::async_learner && !TrainConfig::frozen_acting),
+                "inference server requires the async learner and eager acting");
+  static constexpr bool use_inference_server = TrainConfig::inference_server;
+  using WorkerInferenceServer = InferenceServer<WorkerDQN>;
+  using WorkerInferenceClient = InferenceClient<WorkerInferenceServer>;
+
+  // actor 0 draws from the caller's engine, the threaded actors from their own
+  template <std::size_t ActorId>
+  using ActorRandomEngine = std::conditional_t<
+      ActorId == 0, RandomEngine,
+      ::RandomEngine<float, TrainConfig::actor_seed + BoardConfig::seed_offset +
+                                ActorId> &>;
 
   template <std::size_t ActorId>
   using ActorType =
       Actor<ActorId, DeviceType, BoardConfig, WorkerModelConfig,
-            CityTileModelConfig, WorkerFeatureBuilder, CityTileFeatureBuilder,
-            WorkerRewardEngine<DeviceType>, CityTileRewardEngine<DeviceType>, WorkerReplayBuffer,
-            CityTileReplayBuffer, RandomEngine>;
+            CityTileModelConfig, WorkerFeatures, CityTileFeatureBuilder,
+            WorkerRewardEngine<DeviceType, BoardConfig>, CityTileRewardEngine<DeviceType>, WorkerReplayBuffer,
+            CityTileReplayBuffer, ActorRandomEngine<ActorId>>;
 
-  using Actors = std::tuple<ActorType<0>>;
-  static_assert(ActorCount == 1, "Unsupported");
+  using Actors = indexed_tuple_t<ActorType, ActorCount>;
+  static_assert(ActorCount >= 1, "at least one actor");
+  static_assert(ActorCount == 1 || TrainConfig::async_learner,
+                "several actors require the async learner");
 
 	Trainer() : 
 		m_worker_dqn(WorkerModelConfig::channels, BoardConfig::size,
@@ -75,44 +152,117 @@ public:
                            unsigned(BoardConfig::size),
                            static_cast<uint64_t>(CityTileActions::Count)),
 		
-    m_worker_replay_buffer(
-        HyperParameters::m_replay_capacity,
-        HyperParameters::m_replay_batch_size, HyperParameters::m_replay_alpha,
-        HyperParameters::m_replay_beta, HyperParameters::m_replay_beta_decay),
-
-    m_citytile_replay_buffer(
-        HyperParameters::m_replay_capacity,
-        HyperParameters::m_replay_batch_size, HyperParameters::m_replay_alpha,
-        HyperParameters::m_replay_beta, HyperParameters::m_replay_beta_decay),
+    m_worker_replay_buffer(makeReplayBuffer<WorkerReplayBuffer>(
+        board_path<BoardConfig>(TrainConfig::worker_replay_path))),
+    m_citytile_replay_buffer(makeReplayBuffer<CityTileReplayBuffer>(
+        board_path<BoardConfig>(TrainConfig::citytile_replay_path))),
 
     m_worker_reward_engine(),
     m_citytile_reward_engine(),
 
-		m_actors(tuple_builder<Actors>::create(
-        HyperParameters::m_actor_epsilon_decay,
-        HyperParameters::m_actor_epsilon_start,
-        HyperParameters::m_actor_epsilon_end,
-        HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
-        HyperParameters::m_nn_v_max, HyperParameters::m_nn_step_size,
-        HyperParameters::m_nn_gamma, HyperParameters::m_replay_batch_size))
+		m_actors(makeActors(std::make_index_sequence<ActorCount>{}))
 
  	{
 		m_worker_dqn.to(DeviceType);
 		m_citytile_dqn.to(DeviceType);
+		if constexpr (TrainConfig::channels_last && DeviceType == torch::kCPU &&
+									has_channels_last<WorkerDQN>::value) {
+			at::globalContext().setUserEnabledMkldnn(true);
+			m_worker_dqn.toChannelsLast();
+			m_worker_model_learner.toChannelsLast();
+		}
+		m_worker_model_learner.seedNoise(
+			std::remove_reference_t<RandomEngine>::getInstance().getGenerator()());
+
+		if constexpr (TrainConfig::async_learner) {
+			m_worker_acting_dqn = makeActingDQN();
+			if constexpr (!use_inference_server) {
+				for (auto &resources : m_actor_resources) {
+					resources.m_acting_dqn = makeActingDQN();
+					if constexpr (TrainConfig::frozen_acting) {
+						resources.m_frozen_dqn = std::make_unique<WorkerFrozenDQN>(
+							*resources.m_acting_dqn, WorkerModelConfig::channels, BoardConfig::size);
+					}
+				}
+			}
+			if constexpr (TrainConfig::shared_weights) {
+				m_worker_snapshot = std::make_unique<WorkerSnapshot>(m_worker_dqn,
+					BoardConfig::size == default_board_size
+						? weights_key : sized_weights_key_base + BoardConfig::size);
+			} else {
+				m_worker_snapshot = std::make_unique<WorkerSnapshot>(m_worker_dqn);
+			}
+			m_worker_snapshot->publish(m_worker_dqn);
+			m_worker_async_learner = std::make_unique<WorkerAsyncLearner>(
+				m_worker_model_learner, m_worker_dqn, m_worker_replay_buffer,
+				*m_worker_snapshot, HyperParameters::m_replay_capacity,
+				HyperParameters::m_learner_replay_ratio,
+				HyperParameters::m_learner_publish_interval,
+				HyperParameters::m_learner_max_lag);
+			if constexpr (use_inference_server) {
+				// the server thread is the only reader of the acting network
+				m_worker_inference_server = std::make_unique<WorkerInferenceServer>(
+					*m_worker_acting_dqn, TrainConfig::inference_max_rows,
+					std::chrono::microseconds(TrainConfig::inference_max_latency_us),
+					TrainConfig::inference_stats_interval, [this] {
+						m_worker_snapshot->acquire(*m_worker_acting_dqn,
+																			 m_worker_acting_version);
+					});
+			}
+		}
+		if constexpr (TrainConfig::frozen_acting) {
+			m_worker_frozen_dqn = std::make_unique<WorkerFrozenDQN>(
+				actingWorkerDQN(), WorkerModelConfig::channels, BoardConfig::size);
+		}
 	}
 	
+  // turn_ may drop the synchronous learner step when the turn runs short
   inline ActionReturn processEpisode(const kit::Agent& _agent, RandomEngine& random_engine_,
-		 const std::size_t _frame, const std::size_t _episode) {
+		 const std::size_t _frame, const std::size_t _episode, TurnScheduler& turn_) {
 
 		auto &actor0 = std::get<0>(m_actors);
-		actor0.processEpisode(_agent, m_worker_dqn, m_citytile_dqn, m_worker_replay_buffer,
-													m_citytile_replay_buffer, m_worker_reward_engine,
-													m_citytile_reward_engine, random_engine_);
-		
-		if (_frame > HyperParameters::m_replay_capacity) {
-			m_worker_model_learner.train(_frame, m_worker_replay_buffer, random_engine_);
-			// citytile_model_trainer.train(frame, citytile_replay_buffer,
-			// random_engine_);
+		if constexpr (use_inference_server) {
+			WorkerInferenceClient client(*m_worker_inference_server);
+			actor0.processEpisode(_agent, client, m_citytile_dqn,
+														m_worker_replay_buffer, m_citytile_replay_buffer,
+														m_worker_reward_engine, m_citytile_reward_engine,
+														random_engine_);
+			m_worker_async_learner->notifyFrame(
+				ActorCount == 1 ? _frame : m_frames.fetch_add(1) + 1);
+		} else if constexpr (TrainConfig::async_learner) {
+			// act on the latest published weights, train off the response path
+			const bool updated = m_worker_snapshot->acquire(*m_worker_acting_dqn,
+																											m_worker_acting_version);
+			if constexpr (TrainConfig::frozen_acting) {
+				if (updated) {
+					m_worker_frozen_dqn->refresh(*m_worker_acting_dqn);
+				}
+			}
+			actor0.processEpisode(_agent, actingWorkerModel(), m_citytile_dqn,
+														m_worker_replay_buffer, m_citytile_replay_buffer,
+														m_worker_reward_engine, m_citytile_reward_engine,
+														random_engine_);
+			m_worker_async_learner->notifyFrame(
+				ActorCount == 1 ? _frame : m_frames.fetch_add(1) + 1);
+		} else {
+			if constexpr (TrainConfig::frozen_acting) {
+				if (_frame % HyperParameters::m_learner_publish_interval == 0) {
+					m_worker_frozen_dqn->refresh(m_worker_dqn);
+				}
+			}
+			actor0.processEpisode(_agent, actingWorkerModel(), m_citytile_dqn,
+														m_worker_replay_buffer, m_citytile_replay_buffer,
+														m_worker_reward_engine, m_citytile_reward_engine,
+														random_engine_);
+
+			if (is_replay_warm(m_worker_replay_buffer, _frame,
+												 HyperParameters::m_replay_capacity)) {
+				turn_.run(TurnStage::Learner, [&] {
+					m_worker_model_learner.train(_frame, m_worker_replay_buffer, random_engine_);
+				});
+				// citytile_model_trainer.train(frame, citytile_replay_buffer,
+				// random_engine_);
+			}
 		}
 		return ActionReturn(
 			actor0.getBestWorkerActions(), 
@@ -123,22 +273,357 @@ public:
 		std::get<0>(m_actors).resetState();
 	}
 
+	// starts actors 1..ActorCount-1, each on its own thread serving the
+	// environment behind its shm slot; actor 0 stays on the caller's loop
+	void startActors() {
+		startActors(std::make_index_sequence<ActorCount>{});
+	}
+
+	// actor threads waiting on their forwarder poll m_stop_actors, so an
+	// actor whose environment went away still joins
+	~Trainer() {
+		m_stop_actors.store(true, std::memory_order_relaxed);
+		for (auto &thread : m_actor_threads) {
+			thread.join();
+		}
+	}
+
+  // Snapshots everything a restart needs to continue where it stopped:
+  // networks, learners, replay, actor schedule and every RNG. Tensors are
+  // copied on this thread, serialization and the disk write happen on the
+  // checkpoint writer's, as is the TorchScript export of the worker
+  // network. Call between games, after resetState.
+  void checkpoint(const std::size_t _frame, RandomEngine &random_engine_) {
+    torch::serialize::OutputArchive archive, worker_weights;
+    std::vector<torch::Tensor> worker_tensors;
+    const auto snapshot = [&] {
+      torch::serialize::OutputArchive worker_dqn, citytile_dqn, worker_learner,
+          citytile_learner, worker_replay, citytile_replay, actor;
+      save_module_state(worker_dqn, m_worker_dqn);
+      save_module_state(citytile_dqn, m_citytile_dqn);
+      if constexpr (TrainConfig::quantized_inference) {
+        save_module_state(worker_weights, m_worker_dqn);
+      }
+      m_worker_model_learner.save(worker_learner);
+      m_citytile_model_learner.save(citytile_learner);
+      m_worker_replay_buffer.save(worker_replay);
+      m_citytile_replay_buffer.save(citytile_replay);
+      std::get<0>(m_actors).save(actor);
+      archive.write("worker_dqn", worker_dqn);
+      archive.write("citytile_dqn", citytile_dqn);
+      archive.write("worker_learner", worker_learner);
+      archive.write("citytile_learner", citytile_learner);
+      archive.write("worker_replay", worker_replay);
+      archive.write("citytile_replay", citytile_replay);
+      archive.write("actor", actor);
+      archive.write("learner_rng",
+                    c10::IValue(LearnerRandomEngine::getInstance().getState()));
+      archive.write("torch_rng",
+                    at::detail::getDefaultCPUGenerator().get_state());
+      torch::NoGradGuard no_grad;
+      for (const auto &tensor : WeightSnapshot::modelTensors(m_worker_dqn)) {
+        worker_tensors.push_back(tensor.detach().clone());
+      }
+    };
+    if constexpr (TrainConfig::async_learner) {
+      m_worker_async_learner->withLearnerPaused(snapshot);
+    } else {
+      snapshot();
+    }
+    archive.write("rng", c10::IValue(random_engine_.getState()));
+    archive.write("frame", torch::tensor(static_cast<int64_t>(_frame)));
+
+    m_checkpoint_writer.submit(board_path<BoardConfig>(TrainConfig::checkpoint_path),
+                               std::move(archive));
+    m_checkpoint_writer.submit(
+        board_path<BoardConfig>(TrainConfig::worker_checkpoint_path),
+        [worker_tensors](const std::string &_tmp) {
+          auto dqn = makeActingDQN();
+          {
+            torch::NoGradGuard no_grad;
+            auto tensors = WeightSnapshot::modelTensors(*dqn);
+            for (std::size_t i = 0; i < tensors.size(); ++i) {
+              tensors[i].copy_(worker_tensors[i]);
+            }
+          }
+          WorkerFrozenDQN(*dqn, WorkerModelConfig::channels, BoardConfig::size)
+              .save(_tmp);
+        });
+    if constexpr (TrainConfig::quantized_inference) {
+      m_checkpoint_writer.submit(
+          board_path<BoardConfig>(TrainConfig::worker_weights_path),
+          std::move(worker_weights));
+    }
+  }
+
+  // restores a checkpoint written by checkpoint() and returns its frame, or
+  // 0 when there is none
+  std::size_t resume(RandomEngine &random_engine_) {
+    const auto path = board_path<BoardConfig>(TrainConfig::checkpoint_path);
+    if (access(path.c_str(), R_OK) != 0) {
+      return 0;
+    }
+    torch::serialize::InputArchive archive;
+    archive.load_from(path, torch::Device(DeviceType));
+    torch::Tensor frame;
+    c10::IValue rng;
+    const auto restore = [&] {
+      torch::serialize::InputArchive worker_dqn, citytile_dqn, worker_learner,
+          citytile_learner, worker_replay, citytile_replay, actor;
+      c10::IValue learner_rng;
+      torch::Tensor torch_rng;
+      archive.read("worker_dqn", worker_dqn);
+      archive.read("citytile_dqn", citytile_dqn);
+      archive.read("worker_learner", worker_learner);
+      archive.read("citytile_learner", citytile_learner);
+      archive.read("worker_replay", worker_replay);
+      archive.read("citytile_replay", citytile_replay);
+      archive.read("actor", actor);
+      archive.read("learner_rng", learner_rng);
+      archive.read("torch_rng", torch_rng);
+      load_module_state(worker_dqn, m_worker_dqn);
+      load_module_state(citytile_dqn, m_citytile_dqn);
+      m_worker_model_learner.load(worker_learner);
+      m_citytile_model_learner.load(citytile_learner);
+      m_worker_replay_buffer.load(worker_replay);
+      m_citytile_replay_buffer.load(citytile_replay);
+      std::get<0>(m_actors).load(actor);
+      LearnerRandomEngine::getInstance().setState(learner_rng.toStringRef());
+      auto generator = at::detail::getDefaultCPUGenerator();
+      generator.set_state(torch_rng.cpu());
+    };
+    if constexpr (TrainConfig::async_learner) {
+      m_worker_async_learner->withLearnerPaused([&] {
+        restore();
+        m_worker_snapshot->publish(m_worker_dqn);
+      });
+      m_worker_snapshot->acquire(*m_worker_acting_dqn, m_worker_acting_version);
+    } else {
+      restore();
+    }
+    if constexpr (TrainConfig::frozen_acting) {
+      m_worker_frozen_dqn->refresh(actingWorkerDQN());
+    }
+    archive.read("rng", rng);
+    archive.read("frame", frame);
+    random_engine_.setState(rng.toStringRef());
+    m_frames.store(frame.item<int64_t>());
+    std::cout << "resumed from " << path << std::endl;
+    return frame.item<int64_t>();
+  }
+
+  // Continues from the worker weights, online and target, of the trainer
+  // for another board size. Only for models whose parameters do not depend
+  // on the size; optimizer state, replay and schedules stay per size.
+  template <typename OtherTrainer> void shareWorkerWeights(OtherTrainer &other_) {
+    static_assert(is_size_invariant_model<WorkerDQN>::value,
+                  "worker weights depend on the board size");
+    other_.withWorkerLearnerPaused([&] {
+      withWorkerLearnerPaused([&] {
+        m_worker_model_learner.copyWeightsFrom(other_.getWorkerModelLearner());
+        if constexpr (TrainConfig::async_learner) {
+          m_worker_snapshot->publish(m_worker_dqn);
+        }
+      });
+    });
+    // the inference server pulls the published weights itself
+    if constexpr (TrainConfig::async_learner && !use_inference_server) {
+      m_worker_snapshot->acquire(*m_worker_acting_dqn, m_worker_acting_version);
+    }
+    if constexpr (TrainConfig::frozen_acting) {
+      m_worker_frozen_dqn->refresh(actingWorkerDQN());
+    }
+  }
+
+  // runs f while no learner step is in flight
+  template <typename F> void withWorkerLearnerPaused(F &&f) {
+    if constexpr (TrainConfig::async_learner) {
+      m_worker_async_learner->withLearnerPaused(std::forward<F>(f));
+    } else {
+      f();
+    }
+  }
+
+  inline const WorkerModelLearner &getWorkerModelLearner() const {
+    return m_worker_model_learner;
+  }
+
 private:
+  // per threaded actor, actor 0 uses the trainer's own members
+  struct ActorResources {
+    WorkerRewardEngine<DeviceType, BoardConfig> m_worker_reward_engine;
+    CityTileRewardEngine<DeviceType> m_citytile_reward_engine;
+    std::unique_ptr<WorkerDQN> m_acting_dqn;
+    std::unique_ptr<WorkerFrozenDQN> m_frozen_dqn;
+    uint64_t m_acting_version = 0;
+  };
+
+  // Ape-X: one end epsilon per actor, spread geometrically so some actors
+  // keep exploring while others act almost greedily
+  static inline float actorEpsilonEnd(const std::size_t _actor) {
+    if constexpr (ActorCount == 1) {
+      return HyperParameters::m_actor_epsilon_end;
+    } else {
+      return apex_epsilon(_actor, ActorCount,
+                          HyperParameters::m_actor_apex_epsilon,
+                          HyperParameters::m_actor_apex_alpha);
+    }
+  }
+
+  template <std::size_t... ActorIds>
+  static Actors makeActors(std::index_sequence<ActorIds...>) {
+    return Actors(ActorType<ActorIds>(
+        HyperParameters::m_actor_epsilon_decay,
+        HyperParameters::m_actor_epsilon_start, actorEpsilonEnd(ActorIds),
+        HyperParameters::m_nn_atom_count, HyperParameters::m_nn_v_min,
+        HyperParameters::m_nn_v_max, HyperParameters::m_nn_step_size,
+        HyperParameters::m_nn_gamma, HyperParameters::m_replay_batch_size)...);
+  }
+
+  template <std::size_t... ActorIds>
+  void startActors(std::index_sequence<ActorIds...>) {
+    (startActor<ActorIds>(), ...);
+  }
+
+  template <std::size_t ActorId> void startActor() {
+    if constexpr (ActorId > 0) {
+      char *membuf = initialize_memory_map(actor_slot_key(ActorId));
+      m_actor_threads.emplace_back(&Trainer::runActor<ActorId>, this, membuf);
+    }
+  }
+
+  // the shm protocol loop of main for one threaded actor: pulls the latest
+  // published weights every turn and pushes into the shared replay
+  template <std::size_t ActorId> void runActor(char *membuf_) {
+    auto &actor = std::get<ActorId>(m_actors);
+    auto &resources = m_actor_resources[ActorId - 1];
+    auto &random_engine =
+        std::remove_reference_t<ActorRandomEngine<ActorId>>::getInstance();
+    kit::Agent agent;
+    bool is_new_game = false;
+    while (wait_for_next_msg(membuf_, m_stop_actors, is_new_game)) {
+      if (is_new_game) {
+        actor.resetState();
+        initialize_game(agent, membuf_);
+        if (agent.mapWidth != BoardConfig::size) {
+          std::cerr << "actor " << ActorId << ": map size " << agent.mapWidth
+                    << ", threaded actors only play " << BoardConfig::size
+                    << std::endl;
+          exit(1);
+        }
+        continue;
+      }
+      agent.updateServer(membuf_);
+      if constexpr (use_inference_server) {
+        WorkerInferenceClient client(*m_worker_inference_server);
+        actor.processEpisode(agent, client, m_citytile_dqn,
+                             m_worker_replay_buffer, m_citytile_replay_buffer,
+                             resources.m_worker_reward_engine,
+                             resources.m_citytile_reward_engine, random_engine);
+      } else if constexpr (TrainConfig::frozen_acting) {
+        const bool updated = m_worker_snapshot->acquire(
+            *resources.m_acting_dqn, resources.m_acting_version);
+        if (updated) {
+          resources.m_frozen_dqn->refresh(*resources.m_acting_dqn);
+        }
+        actor.processEpisode(agent, *resources.m_frozen_dqn, m_citytile_dqn,
+                             m_worker_replay_buffer, m_citytile_replay_buffer,
+                             resources.m_worker_reward_engine,
+                             resources.m_citytile_reward_engine, random_engine);
+      } else {
+        m_worker_snapshot->acquire(*resources.m_acting_dqn,
+                                   resources.m_acting_version);
+        actor.processEpisode(agent, *resources.m_acting_dqn, m_citytile_dqn,
+                             m_worker_replay_buffer, m_citytile_replay_buffer,
+                             resources.m_worker_reward_engine,
+                             resources.m_citytile_reward_engine, random_engine);
+      }
+      send_actions(agent,
+                   ActionReturn(actor.getBestWorkerActions(),
+                                actor.getBestCityTileActions()),
+                   membuf_);
+      if (!wait_for_client_to_forward_actions(membuf_, m_stop_actors)) {
+        break;
+      }
+      m_worker_async_learner->notifyFrame(m_frames.fetch_add(1) + 1);
+    }
+  }
+
+  static inline std::unique_ptr<WorkerDQN> makeActingDQN() {
+    auto dqn = std::make_unique<WorkerDQN>(
+        WorkerModelConfig::channels, BoardConfig::size,
+        static_cast<uint64_t>(WorkerActions::Count),
+        HyperParameters::m_nn_std_init, HyperParameters::m_nn_atom_count,
+        HyperParameters::m_nn_v_min, HyperParameters::m_nn_v_max);
+    dqn->to(DeviceType);
+    if constexpr (TrainConfig::channels_last && DeviceType == torch::kCPU &&
+                  has_channels_last<WorkerDQN>::value) {
+      dqn->toChannelsLast();
+    }
+    return dqn;
+  }
+
+  // eager network the acting side reads weights from
+  inline WorkerDQN &actingWorkerDQN() {
+    if constexpr (TrainConfig::async_learner) {
+      return *m_worker_acting_dqn;
+    } else {
+      return m_worker_dqn;
+    }
+  }
+
+  // what the actor runs forward on
+  inline decltype(auto) actingWorkerModel() {
+    if constexpr (TrainConfig::frozen_acting) {
+      return *m_worker_frozen_dqn;
+    } else {
+      return actingWorkerDQN();
+    }
+  }
+
+  template <typename ReplayBuf>
+  static inline ReplayBuf makeReplayBuffer(const std::string &_path) {
+    if constexpr (ReplayBuf::is_persistent) {
+      return ReplayBuf(
+          HyperParameters::m_replay_capacity,
+          HyperParameters::m_replay_batch_size, HyperParameters::m_replay_alpha,
+          HyperParameters::m_replay_beta, HyperParameters::m_replay_beta_decay,
+          _path);
+    } else {
+      return ReplayBuf(
+          HyperParameters::m_replay_capacity,
+          HyperParameters::m_replay_batch_size, HyperParameters::m_replay_alpha,
+          HyperParameters::m_replay_beta, HyperParameters::m_replay_beta_decay);
+    }
+  }
+
 	WorkerDQN m_worker_dqn;
 	CityTileDQN m_citytile_dqn;
 
-  ModelLearner<WorkerDQN, DeviceType,
-                 static_cast<std::size_t>(WorkerActions::Count)>
-    m_worker_model_learner;
-  ModelLearner<CityTileDQN, DeviceType,
-                 static_cast<std::size_t>(CityTileActions::Count)>
-    m_citytile_model_learner;
+  WorkerModelLearner m_worker_model_learner;
+  CityTileModelLearner m_citytile_model_learner;
 
   WorkerReplayBuffer m_worker_replay_buffer;
   CityTileReplayBuffer m_citytile_replay_buffer;
-  WorkerRewardEngine<DeviceType> m_worker_reward_engine;
+  WorkerRewardEngine<DeviceType, BoardConfig> m_worker_reward_engine;
   CityTileRewardEngine<DeviceType> m_citytile_reward_engine;
   Actors m_actors;
+  CheckpointWriter m_checkpoint_writer;
+
+  // async learner only, declared last so the learner thread stops first
+  std::unique_ptr<WorkerDQN> m_worker_acting_dqn;
+  std::unique_ptr<WorkerSnapshot> m_worker_snapshot;
+  uint64_t m_worker_acting_version = 0;
+  std::unique_ptr<WorkerAsyncLearner> m_worker_async_learner;
+  // frozen_acting only
+  std::unique_ptr<WorkerFrozenDQN> m_worker_frozen_dqn;
+  // inference_server only, stopped after the actors that submit to it
+  std::unique_ptr<WorkerInferenceServer> m_worker_inference_server;
+  // threaded actors (ActorCount > 1 only)
+  std::array<ActorResources, ActorCount - 1> m_actor_resources;
+  std::atomic<std::size_t> m_frames{0};
+  std::atomic<bool> m_stop_actors{false};
+  std::vector<std::thread> m_actor_threads;
 };
 
 #endif /* TRAINER_HPP_ */
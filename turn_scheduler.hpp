@@ -0,0 +1,142 @@
+#ifndef TURN_SCHEDULER_HPP_
+#define TURN_SCHEDULER_HPP_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+// stages of a turn that can be dropped when time runs short
+enum class TurnStage { Inference, Learner, Count };
+
+// Wall clock budget of one turn. The engine allows _turn_limit_ms per turn
+// and charges anything beyond it to an overage bank of _overage_ms per game;
+// an empty bank forfeits. The turn is timed from the moment its observation
+// arrives. Optional stages run through run(), which keeps a running estimate
+// of each stage's cost and, when _enabled, only admits a stage whose
+// estimate still fits in what is left of the turn. A stage may also draw on
+// its share of the bank, the bank spread evenly over the turns left. A
+// skipped stage decays its estimate so one slow outlier does not lock it out
+// for the rest of the game. Overruns and skips are logged per turn, totals
+// per game.
+class TurnScheduler {
+public:
+  using clock = std::chrono::steady_clock;
+  using milliseconds = std::chrono::duration<double, std::milli>;
+
+  TurnScheduler(const double _turn_limit_ms, const double _overage_ms,
+                const double _safety_ms, const bool _enabled)
+      : m_turn_limit(_turn_limit_ms), m_overage(_overage_ms),
+        m_safety(_safety_ms), m_enabled(_enabled), m_bank(_overage_ms) {}
+
+  // prints the totals of the game before, if any, and refills the bank
+  void startGame() {
+    if (m_turns > 0) {
+      std::cout << "turn budget: " << m_turns << " turns, " << m_overruns
+                << " over the limit, " << (m_overage - m_bank)
+                << " ms overage used, " << m_skipped[stage(TurnStage::Learner)]
+                << " learner steps and "
+                << m_skipped[stage(TurnStage::Inference)]
+                << " inferences skipped" << std::endl;
+    }
+    m_bank = m_overage;
+    m_turns = 0;
+    m_overruns = 0;
+    m_skipped.fill(0);
+  }
+
+  void startTurn(const int _turns_left) {
+    m_turn_start = clock::now();
+    m_turns_left = std::max(_turns_left, 1);
+    m_turn_skipped.fill(false);
+  }
+
+  inline double elapsed() const {
+    return milliseconds(clock::now() - m_turn_start).count();
+  }
+
+  // whether _stage is expected to finish in time, _overdraw lets it use
+  // its share of the overage bank
+  bool admit(const TurnStage _stage, const bool _overdraw = false) const {
+    if (!m_enabled) {
+      return true;
+    }
+    const double limit = m_turn_limit - m_safety +
+                         (_overdraw ? std::max(m_bank, 0.) / m_turns_left : 0.);
+    return elapsed() + m_estimate[stage(_stage)] <= limit;
+  }
+
+  // runs f if admit, timing it into the stage's estimate. false if skipped
+  template <typename F>
+  bool run(const TurnStage _stage, F &&f, const bool _overdraw = false) {
+    const std::size_t s = stage(_stage);
+    if (!admit(_stage, _overdraw)) {
+      m_estimate[s] *= estimate_decay;
+      m_turn_skipped[s] = true;
+      ++m_skipped[s];
+      return false;
+    }
+    const auto start = clock::now();
+    f();
+    const double cost = milliseconds(clock::now() - start).count();
+    m_estimate[s] = m_samples[s]++ == 0
+                        ? cost
+                        : m_estimate[s] + estimate_alpha * (cost - m_estimate[s]);
+    return true;
+  }
+
+  // charges any overrun to the bank, returns it in ms
+  double endTurn() {
+    const double total = elapsed();
+    const double overrun = std::max(total - m_turn_limit, 0.);
+    m_bank -= overrun;
+    ++m_turns;
+    const bool skipped_learner = m_turn_skipped[stage(TurnStage::Learner)];
+    const bool skipped_inference = m_turn_skipped[stage(TurnStage::Inference)];
+    if (overrun > 0) {
+      ++m_overruns;
+    }
+    if (overrun > 0 || skipped_learner || skipped_inference) {
+      std::cout << "turn " << m_turns << ": " << total << " ms, overrun "
+                << overrun << " ms, overage bank " << m_bank << " ms"
+                << (skipped_learner ? ", learner skipped" : "")
+                << (skipped_inference ? ", inference skipped" : "")
+                << std::endl;
+    }
+    return overrun;
+  }
+
+  inline double getBank() const { return m_bank; }
+  inline double getEstimate(const TurnStage _stage) const {
+    return m_estimate[stage(_stage)];
+  }
+  inline std::size_t getSkipped(const TurnStage _stage) const {
+    return m_skipped[stage(_stage)];
+  }
+
+private:
+  static constexpr std::size_t stages = static_cast<std::size_t>(TurnStage::Count);
+  static constexpr double estimate_alpha = .2;
+  static constexpr double estimate_decay = .9;
+
+  static inline std::size_t stage(const TurnStage _stage) {
+    return static_cast<std::size_t>(_stage);
+  }
+
+  const double m_turn_limit;
+  const double m_overage;
+  const double m_safety;
+  const bool m_enabled;
+  double m_bank;
+  int m_turns_left = 1;
+  std::size_t m_turns = 0;
+  std::size_t m_overruns = 0;
+  clock::time_point m_turn_start = clock::now();
+  std::array<double, stages> m_estimate{};
+  std::array<std::size_t, stages> m_samples{};
+  std::array<std::size_t, stages> m_skipped{};
+  std::array<bool, stages> m_turn_skipped{};
+};
+
+#endif /* TURN_SCHEDULER_HPP_ */
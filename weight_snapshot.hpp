@@ -0,0 +1,66 @@
+#ifndef WEIGHT_SNAPSHOT_HPP_
+#define WEIGHT_SNAPSHOT_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <torch/torch.h>
+#include <vector>
+
+// Versioned copy of a model's parameters and buffers. The learner publishes
+// into it, the acting thread pulls a new version between turns.
+class WeightSnapshot {
+public:
+  template <typename Model>
+  WeightSnapshot(const Model &_like) : m_version(0) {
+    torch::NoGradGuard no_grad;
+    for (const auto &tensor : modelTensors(_like)) {
+      m_tensors.push_back(tensor.detach().clone());
+    }
+  }
+
+  inline uint64_t getVersion() const {
+    return m_version.load(std::memory_order_acquire);
+  }
+
+  template <typename Model> void publish(const Model &_model) {
+    torch::NoGradGuard no_grad;
+    const auto tensors = modelTensors(_model);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (std::size_t i = 0; i < tensors.size(); ++i) {
+      m_tensors[i].copy_(tensors[i]);
+    }
+    m_version.fetch_add(1, std::memory_order_release);
+  }
+
+  // copies into model_ only if a newer version than version_ was published
+  template <typename Model> bool acquire(Model &model_, uint64_t &version_) {
+    if (getVersion() == version_) {
+      return false;
+    }
+    torch::NoGradGuard no_grad;
+    auto tensors = modelTensors(model_);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (std::size_t i = 0; i < tensors.size(); ++i) {
+      tensors[i].copy_(m_tensors[i]);
+    }
+    version_ = m_version.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  // parameters then buffers, in registration order
+  template <typename Model>
+  static std::vector<torch::Tensor> modelTensors(const Model &_model) {
+    auto tensors = _model.parameters(true);
+    const auto buffers = _model.buffers(true);
+    tensors.insert(tensors.end(), buffers.begin(), buffers.end());
+    return tensors;
+  }
+
+private:
+  std::vector<torch::Tensor> m_tensors;
+  std::atomic<uint64_t> m_version;
+  std::mutex m_mutex;
+};
+
+#endif /* WEIGHT_SNAPSHOT_HPP_ */